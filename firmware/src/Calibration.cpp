@@ -1,128 +1,239 @@
 #include <math.h>
-#include <Arduino.h>
+#include "Hal.hpp"
+#include "Calibration.hpp"
+
+// Built-in calibration tables, used until a sweep has been saved. Each entry
+// is the value actually observed (in millivolts or milliamps) at evenly spaced
+// grid points from zero to the maximum value. They stay in flash; every
+// channel starts out with a copy.
 
 // Voltage output calibration
-float vOutCal[] = {
-    0.014,
-    0.998,
-    1.987,
-    2.971,
-    3.93,
-    4.951,
-    5.929,
-    6.907,
-    7.899,
-    8.873,
-    9.852,
-    10.836,
-    11.810,
-    12.785,
-    13.768,
-    14.747,
-    15.732,
-    16.704,
-    17.694,
-    18.683,
-    19.667,
-    20.638,
-    21.621,
-    22.604,
-    23.584,
-    24.551,
-    25.529,
-    26.511,
-    27.500,
-    28.471,
-    29.447};
+static const int16_t builtinVOut[CAL_V_POINTS] PROGMEM = {
+    14,
+    998,
+    1987,
+    2971,
+    3930,
+    4951,
+    5929,
+    6907,
+    7899,
+    8873,
+    9852,
+    10836,
+    11810,
+    12785,
+    13768,
+    14747,
+    15732,
+    16704,
+    17694,
+    18683,
+    19667,
+    20638,
+    21621,
+    22604,
+    23584,
+    24551,
+    25529,
+    26511,
+    27500,
+    28471,
+    29447};
 
 // Current output calibration
-float iOutCal[] = {
-    0.001,
-    0.108,
-    0.235,
-    0.361,
-    0.454,
-    0.529,
-    0.613,
-    0.712,
-    0.812,
-    0.908,
-    1.04,
-    1.130,
-    1.250,
-    1.3,
-    1.4,
-    1.5,
-    1.6,
-    1.7,
-    1.8,
-    1.9,
-    2.0};
-
-float iMeasCal[] = {
-    0.0,  // 0.0
-    0.41, // 0.1
-    0.58, // 0.2
-    0.62, // 0.3
-    0.72, // 0.4
-    0.84, // 0.5
-    0.82, // 0.6
-    1.00, // 0.7
-    1.07, // 0.8
-    1.15, // 0.9
-    1.23, // 1.0
-    1.31, // 1.1
-    1.37, // 1.2
-    1.43, // 1.3
-    1.51, // 1.4
-    1.57, // 1.5
-    1.64, // 1.6
-    1.7,  // 1.7
-    1.8,  // 1.8
-    1.9,  // 1.9
-    2.0   // 2.0
+static const int16_t builtinIOut[CAL_I_POINTS] PROGMEM = {
+    1,
+    108,
+    235,
+    361,
+    454,
+    529,
+    613,
+    712,
+    812,
+    908,
+    1040,
+    1130,
+    1250,
+    1300,
+    1400,
+    1500,
+    1600,
+    1700,
+    1800,
+    1900,
+    2000};
+
+static const int16_t builtinIReading[CAL_I_POINTS] PROGMEM = {
+    0,    // 0.0
+    410,  // 0.1
+    580,  // 0.2
+    620,  // 0.3
+    720,  // 0.4
+    840,  // 0.5
+    820,  // 0.6
+    1000, // 0.7
+    1070, // 0.8
+    1150, // 0.9
+    1230, // 1.0
+    1310, // 1.1
+    1370, // 1.2
+    1430, // 1.3
+    1510, // 1.4
+    1570, // 1.5
+    1640, // 1.6
+    1700, // 1.7
+    1800, // 1.8
+    1900, // 1.9
+    2000  // 2.0
 };
 
-float vMeasCal[] = {
-    -0.13,
-    0.92,
-    1.94,
-    2.97,
-    3.98,
-    5.01,
-    6.05,
-    7.05,
-    8.07,
-    9.09,
-    10.11,
-    11.12,
-    12.15,
-    13.17,
-    14.19,
-    15.21,
-    16.22,
-    17.23,
-    18.25,
-    19.28,
-    20.30,
-    21.32,
-    22.34,
-    23.37,
-    24.39,
-    25.40,
-    26.42,
-    27.44,
-    28.46,
-    29.48,
-    30.50,
+static const int16_t builtinVReading[CAL_V_POINTS] PROGMEM = {
+    -130,
+    920,
+    1940,
+    2970,
+    3980,
+    5010,
+    6050,
+    7050,
+    8070,
+    9090,
+    10110,
+    11120,
+    12150,
+    13170,
+    14190,
+    15210,
+    16220,
+    17230,
+    18250,
+    19280,
+    20300,
+    21320,
+    22340,
+    23370,
+    24390,
+    25400,
+    26420,
+    27440,
+    28460,
+    29480,
+    30500,
 };
 
-float lerp(float y1, float y2, float dx, float y)
+#define CAL_INDEX_SHIFT 26 // Precision of the reciprocal used to find the segment
+
+static_assert(NUM_CHANNELS * sizeof(int16_t) * CAL_POINTS <= PERSIST_BLOCK_MAX,
+              "Calibration tables don't fit in EEPROM");
+
+Calibration::Calibration()
 {
-    return y * ((y2 - y1) / dx);
+    uint8_t at = 0;
+    place(calVOutput, at, builtinVOut, CAL_V_POINTS, -1, 30000);
+    place(calIOutput, at, builtinIOut, CAL_I_POINTS, -1, 2000);
+    place(calIReading, at, builtinIReading, CAL_I_POINTS, 1, 2000);
+    place(calVReading, at, builtinVReading, CAL_V_POINTS, 1, 30000);
+}
+
+void Calibration::place(CalTableId id, uint8_t &at, const int16_t *builtin, uint8_t n, int8_t sign, uint16_t maxValue)
+{
+    CalTable &t = tables[id];
+    t.points = points + at;
+    t.slopes = slopes + at - id;
+    t.n = n;
+    t.shift = 0;
+    t.sign = sign;
+    t.maxValue = maxValue;
+    memcpy_P(t.points, builtin, n * sizeof(int16_t));
+    at += n;
+}
+
+static void prepare(CalTable &t)
+{
+    t.step = t.maxValue / (t.n - 1);
+    t.invStep = ((1UL << CAL_INDEX_SHIFT) + t.step - 1) / t.step;
+
+    // Use the finest scale where every slope still fits in 16 bits
+    int32_t maxDiff = 0;
+    for (uint8_t i = 0; i < t.n - 1; i++)
+    {
+        int32_t diff = abs((int32_t)t.points[i + 1] - t.points[i] - t.step);
+        maxDiff = max(maxDiff, diff);
+    }
+    t.shift = 15;
+    while (t.shift > 0 && ((maxDiff << t.shift) / t.step) > 32767)
+    {
+        t.shift--;
+    }
+    for (uint8_t i = 0; i < t.n - 1; i++)
+    {
+        int32_t diff = (int32_t)t.points[i + 1] - t.points[i] - t.step;
+        int32_t scaled = diff << t.shift;
+        t.slopes[i] = (scaled + (scaled < 0 ? -(int32_t)t.step : (int32_t)t.step) / 2) / t.step;
+    }
 }
 
-float toCalibrated(float raw, float table[], int n, float maxValue, float sign)
+static int32_t toCalibrated(const CalTable &t, int32_t raw)
+{
+    if (raw > t.maxValue || raw < 0)
+    {
+        return raw;
+    }
+    uint8_t idx = ((uint32_t)raw * t.invStep) >> CAL_INDEX_SHIFT;
+    int32_t nearest = (int32_t)idx * t.step;
+    int32_t error = t.points[idx] - nearest;
+
+    // Increase precision using linear interpolation (unless we're at the end of the table)
+    if (idx < t.n - 1)
+    {
+        error += ((raw - nearest) * t.slopes[idx] + (1L << t.shift >> 1)) >> t.shift;
+    }
+    int32_t v = t.sign > 0 ? raw + error : raw - error;
+    return v < 0 ? 0 : v;
+}
+
+void Calibration::init()
+{
+    for (uint8_t i = 0; i < CAL_TABLES; i++)
+    {
+        prepare(tables[i]);
+    }
+}
+
+void Calibration::setPoint(CalTableId id, uint8_t i, int16_t v)
+{
+    if (i < tables[id].n)
+    {
+        tables[id].points[i] = v;
+    }
+}
+
+uint32_t Calibration::toVOutput(uint32_t v)
+{
+    return toCalibrated(tables[calVOutput], v);
+}
+
+uint32_t Calibration::toIOutput(uint32_t i)
+{
+    return toCalibrated(tables[calIOutput], i);
+}
+
+int32_t Calibration::toIReading(int32_t i)
+{
+    return toCalibrated(tables[calIReading], i);
+}
+
+int32_t Calibration::toVReading(int32_t v)
+{
+    return toCalibrated(tables[calVReading], v);
+}
+
+#ifdef CAL_BENCH
+// The original floating point implementation, kept as a reference for
+// benchmarkCalibration().
+static float toCalibratedFloat(float raw, const int16_t table[], int n, float maxValue, float sign)
 {
     float scale = maxValue / ((float)n - 1);
     if (raw > maxValue || raw < 0)
@@ -135,46 +246,52 @@ float toCalibrated(float raw, float table[], int n, float maxValue, float sign)
         return raw;
     }
     float nearest = (float)idx * scale;
-    float error = table[idx] - nearest;
-
-    // Increase precision using linear interpolation (unless we're at the end of the table)
+    float error = (float)table[idx] / 1000 - nearest;
     if (idx < n - 1)
     {
         float next = (float)(idx + 1) * scale;
-        float adj = lerp(table[idx] - nearest, table[idx + 1] - next, scale, raw - nearest);
-        error += adj;
-        /*
-        Serial.print("raw=");
-        Serial.print(raw);
-        Serial.print(" nearest=");
-        Serial.print(nearest);
-        Serial.print(" next=");
-        Serial.print(next);
-        Serial.print(" adj=");
-        Serial.print(adj);
-        Serial.print(" error=");
-        Serial.println(error);
-        */
+        float y1 = (float)table[idx] / 1000 - nearest;
+        float y2 = (float)table[idx + 1] / 1000 - next;
+        error += (raw - nearest) * ((y2 - y1) / scale);
     }
     return fmax(0, raw + sign * error);
 }
 
-uint32_t toCalibratedVOutput(uint32_t v)
-{
-    return (uint32_t)(toCalibrated(((float)v) / 1000, vOutCal, sizeof(vOutCal) / sizeof(float), 30.0, -1) * 1000);
-}
-
-uint32_t toCalibratedIOutput(uint32_t i)
-{
-    return (uint32_t)(toCalibrated(((float)i) / 1000, iOutCal, sizeof(iOutCal) / sizeof(float), 2.0, -1) * 1000);
-}
-
-float toCalibratedIReading(float i)
+static void benchmarkTable(const CalTable &t, CalBenchResult &result)
 {
-    return toCalibrated(i / 1000, iMeasCal, sizeof(iMeasCal) / sizeof(float), 2.0, 1) * 1000;
+    volatile int32_t sink;
+    float maxValue = (float)t.maxValue / 1000;
+    uint32_t start = hal::micros();
+    for (int32_t raw = 0; raw <= t.maxValue; raw++)
+    {
+        sink = (int32_t)(toCalibratedFloat((float)raw / 1000, t.points, t.n, maxValue, t.sign) * 1000);
+    }
+    result.floatUs += hal::micros() - start;
+    start = hal::micros();
+    for (int32_t raw = 0; raw <= t.maxValue; raw++)
+    {
+        sink = toCalibrated(t, raw);
+    }
+    result.fixedUs += hal::micros() - start;
+    for (int32_t raw = 0; raw <= t.maxValue; raw++)
+    {
+        int32_t ref = (int32_t)(toCalibratedFloat((float)raw / 1000, t.points, t.n, maxValue, t.sign) * 1000);
+        int32_t diff = abs(toCalibrated(t, raw) - ref);
+        result.maxError = max(result.maxError, diff);
+    }
+    result.calls += t.maxValue + 1;
+    (void)sink;
 }
 
-float toCalibratedVReading(float v)
+void Calibration::benchmark(CalBenchResult &result)
 {
-    return toCalibrated(v / 1000, vMeasCal, sizeof(vMeasCal) / sizeof(float), 30.0, 1) * 1000;
+    result.calls = 0;
+    result.floatUs = 0;
+    result.fixedUs = 0;
+    result.maxError = 0;
+    for (uint8_t i = 0; i < CAL_TABLES; i++)
+    {
+        benchmarkTable(tables[i], result);
+    }
 }
+#endif
@@ -1,9 +1,99 @@
-#include <Arduino.h>
+#ifndef __CALIBRATION_HPP
+#define __CALIBRATION_HPP
+#include "Hal.hpp"
+#include "Persist.hpp"
 
-uint32_t toCalibratedVOutput(uint32_t v);
+#define CAL_TABLES 4
+#define CAL_V_POINTS 31 // Grid points of the voltage tables (1 V apart)
+#define CAL_I_POINTS 21 // Grid points of the current tables (0.1 A apart)
+#define CAL_POINTS (2 * CAL_V_POINTS + 2 * CAL_I_POINTS)
 
-uint32_t toCalibratedIOutput(uint32_t i);
+// The tables, in the order they are stored
+enum CalTableId
+{
+    calVOutput,
+    calIOutput,
+    calIReading,
+    calVReading
+};
 
-float toCalibratedIReading(float i);
+// Integer calibration. The error at each grid point is read straight from the
+// table and the slope of the error across each segment is precomputed by
+// init(), so converting a value is one multiply to find the segment and one
+// multiply and shift to interpolate. No division and no floating point.
+struct CalTable
+{
+    int16_t *points;   // Calibrated values at the grid points
+    int16_t *slopes;   // Slope of the error across each segment, scaled by 2^shift
+    uint8_t n;         // Number of grid points
+    uint8_t shift;     // Scale of the slopes
+    int8_t sign;       // 1 to add the error (readings), -1 to subtract it (outputs)
+    uint16_t maxValue; // Value at the last grid point
+    uint16_t step;     // Distance between grid points
+    uint32_t invStep;  // 2^CAL_INDEX_SHIFT / step, rounded up
+};
 
-float toCalibratedVReading(float v);
\ No newline at end of file
+#ifdef CAL_BENCH
+struct CalBenchResult
+{
+    uint32_t calls;    // Conversions per implementation
+    uint32_t floatUs;  // Total time spent in the floating point implementation
+    uint32_t fixedUs;  // Total time spent in the integer implementation
+    int32_t maxError;  // Largest difference between the two, in milli-units
+};
+#endif
+
+// The output and reading tables of one channel. All values are in millivolts
+// and milliamps. Call init() once before using any of the conversions, and
+// again after changing the tables.
+class Calibration
+{
+public:
+    // Starts out with the built-in tables
+    Calibration();
+
+    void init();
+
+    // All the tables, back to back, for storing them in EEPROM
+    PersistRegion getRegion()
+    {
+        return {points, sizeof(points)};
+    }
+
+    // Number of grid points in a table. They are evenly spaced from zero to
+    // getMax().
+    uint8_t getPoints(CalTableId id)
+    {
+        return tables[id].n;
+    }
+
+    uint16_t getMax(CalTableId id)
+    {
+        return tables[id].maxValue;
+    }
+
+    // Replaces the value at a grid point. Takes effect at the next init().
+    void setPoint(CalTableId id, uint8_t i, int16_t v);
+
+    uint32_t toVOutput(uint32_t v);
+
+    uint32_t toIOutput(uint32_t i);
+
+    int32_t toIReading(int32_t i);
+
+    int32_t toVReading(int32_t v);
+
+#ifdef CAL_BENCH
+    // Runs every table over its full range through both the original floating
+    // point implementation and the integer one, timing and comparing them.
+    void benchmark(CalBenchResult &result);
+#endif
+
+private:
+    int16_t points[CAL_POINTS];
+    int16_t slopes[CAL_POINTS - CAL_TABLES];
+    CalTable tables[CAL_TABLES];
+
+    void place(CalTableId id, uint8_t &at, const int16_t *builtin, uint8_t n, int8_t sign, uint16_t maxValue);
+};
+#endif
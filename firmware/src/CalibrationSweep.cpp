@@ -0,0 +1,197 @@
+#include "CalibrationSweep.hpp"
+
+// Rounded a / b for b > 0
+static int32_t divRound(int32_t a, int32_t b)
+{
+    return (a + (a < 0 ? -b : b) / 2) / b;
+}
+
+static int16_t clamp16(int32_t v)
+{
+    return v > 32767 ? 32767 : (v < -32768 ? -32768 : v);
+}
+
+void CalibrationSweep::start(Calibration &cal, CalTableId output, CalTableId reading, const uint8_t *refs, uint8_t refCount,
+                             int16_t tolerance)
+{
+    this->cal = &cal;
+    this->output = output;
+    this->reading = reading;
+    this->tolerance = tolerance;
+    refPoints = refs;
+    this->refCount = refCount;
+    points = cal.getPoints(output);
+    if (points > CAL_MAX_POINTS || refCount < 2 || refCount > CAL_MAX_REFS)
+    {
+        state = failed;
+        return;
+    }
+    step = cal.getMax(output) / (points - 1);
+    point = 0;
+    ref = 0;
+    lastReading = 0;
+    count = 0;
+    filled = 0;
+    firstHalf = 0;
+    secondHalf = 0;
+    measured = false;
+    referenced = false;
+    state = settling;
+    changed = true;
+}
+
+void CalibrationSweep::abort()
+{
+    if (isRunning())
+    {
+        state = failed;
+        changed = true;
+    }
+}
+
+void CalibrationSweep::addReading(CalTableId table, int32_t r)
+{
+    if (!isRunning() || table != reading || measured)
+    {
+        return;
+    }
+    if (++count <= CAL_SETTLE_MIN)
+    {
+        return;
+    }
+    if (filled < CAL_HALF)
+    {
+        firstHalf += r;
+    }
+    else
+    {
+        secondHalf += r;
+    }
+    if (++filled < 2 * CAL_HALF)
+    {
+        return;
+    }
+
+    if (labs(firstHalf - secondHalf) <= (int32_t)tolerance * CAL_HALF)
+    {
+        lastReading = divRound(firstHalf + secondHalf, 2 * CAL_HALF);
+        raw[point] = lastReading;
+        measured = true;
+        if (!isRefPoint() || referenced)
+        {
+            next();
+        }
+        else
+        {
+            state = reference;
+        }
+    }
+    else if (count >= CAL_MAX_READINGS)
+    {
+        state = failed;
+        changed = true;
+    }
+    else
+    {
+        // Still moving. Slide the window along by half.
+        firstHalf = secondHalf;
+        secondHalf = 0;
+        filled = CAL_HALF;
+    }
+}
+
+bool CalibrationSweep::setReference(int32_t value)
+{
+    if (!isRunning() || !isRefPoint())
+    {
+        return false;
+    }
+    refTrue[ref] = clamp16(value);
+    referenced = true;
+    if (measured)
+    {
+        next();
+    }
+    return true;
+}
+
+void CalibrationSweep::next()
+{
+    if (isRefPoint())
+    {
+        ref++;
+    }
+    if (point + 1 >= points)
+    {
+        finish();
+        return;
+    }
+    point++;
+    count = 0;
+    filled = 0;
+    firstHalf = 0;
+    secondHalf = 0;
+    measured = false;
+    referenced = false;
+    state = settling;
+    changed = true;
+}
+
+// The true value of a raw reading, interpolated between the references and
+// extrapolated from the outermost pairs of them.
+int32_t CalibrationSweep::fit(const int16_t *refRaw, int32_t r)
+{
+    uint8_t j = 0;
+    while (j < refCount - 2 && r >= refRaw[j + 1])
+    {
+        j++;
+    }
+    return refTrue[j] + divRound((r - refRaw[j]) * ((int32_t)refTrue[j + 1] - refTrue[j]), refRaw[j + 1] - refRaw[j]);
+}
+
+void CalibrationSweep::finish()
+{
+    state = failed;
+    changed = true;
+
+    // Both the readings and the references must go up, or a reference was mistyped
+    int16_t refRaw[CAL_MAX_REFS];
+    for (uint8_t j = 0; j < refCount; j++)
+    {
+        refRaw[j] = raw[refPoints[j]];
+        if (j > 0 && (refRaw[j] <= refRaw[j - 1] || refTrue[j] <= refTrue[j - 1]))
+        {
+            return;
+        }
+    }
+
+    // What the output actually produced at each point. The ADC can't read
+    // below zero, so the bottom of the output table is clamped there.
+    for (uint8_t k = 0; k < points; k++)
+    {
+        int32_t v = fit(refRaw, raw[k]);
+        raw[k] = clamp16(v < 0 ? 0 : v);
+        if (k > 0 && raw[k] <= raw[k - 1])
+        {
+            // Not going up. The output isn't connected the way the sweep expects.
+            return;
+        }
+    }
+
+    for (uint8_t k = 0; k < points; k++)
+    {
+        cal->setPoint(output, k, raw[k]);
+    }
+    uint8_t n = cal->getPoints(reading);
+    uint16_t readingStep = cal->getMax(reading) / (n - 1);
+    for (uint8_t i = 0; i < n; i++)
+    {
+        cal->setPoint(reading, i, clamp16(fit(refRaw, (int32_t)i * readingStep)));
+    }
+    cal->init();
+
+    // The tables won't change again before this is written, as that takes
+    // far less time than another sweep
+    persist.saveBlock(regions, regionCount);
+    state = done;
+}
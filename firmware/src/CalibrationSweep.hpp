@@ -0,0 +1,168 @@
+/*
+Copyright 2023, Pontus Rydin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in
+the Software without restriction, including without limitation the rights to use,
+copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef __CALIBRATION_SWEEP_HPP
+#define __CALIBRATION_SWEEP_HPP
+#include "Hal.hpp"
+#include "Calibration.hpp"
+#include "Persist.hpp"
+
+#define CAL_MAX_POINTS 31    // Largest output table
+#define CAL_MAX_REFS 4       // Reference readings per sweep
+#define CAL_SETTLE_MIN 4     // Readings dropped after each step, for the output and the sample pipeline to settle
+#define CAL_HALF 8           // Readings in each half of the average taken at a point
+#define CAL_MAX_READINGS 375 // Give up on a point that hasn't settled after this many readings (3 s)
+
+// Regenerates an output table and the matching reading table. The sweep
+// steps the output through the grid points of its table and averages the
+// raw readings at each one. At a few of the points it also waits for the
+// true value from a reference meter, which fits the reading table. Every
+// averaged reading is then converted by that fit into the value the output
+// actually produced at its grid point.
+//
+// A point is measured by splitting its readings into two halves and taking
+// the average once the halves agree, so settling and averaging share the
+// same readings. At a reference point the average is taken while the
+// reference is being typed in, and the sweep moves on when both are done.
+class CalibrationSweep
+{
+public:
+    enum State
+    {
+        idle,
+        settling,  // Averaging readings at the current point
+        reference, // Waiting for the reference reading at the current point
+        done,      // New tables are in use and being saved
+        failed     // The tables were left alone
+    };
+
+    // A finished sweep saves the regions, which hold the tables of every
+    // channel, to the EEPROM block
+    CalibrationSweep(Persist &persist, const PersistRegion *regions, uint8_t regionCount)
+        : persist(persist), regions(regions), regionCount(regionCount)
+    {
+    }
+
+    // Starts sweeping output of cal, fitting the raw readings of reading to
+    // the references taken at the grid points in refs (ascending, at least
+    // two). tolerance is how far apart the two halves of an average may be.
+    void start(Calibration &cal, CalTableId output, CalTableId reading, const uint8_t *refs, uint8_t refCount,
+               int16_t tolerance);
+
+    void abort();
+
+    // Call with every decimated raw reading, in milli-units. Readings of
+    // anything but the swept quantity are ignored.
+    void addReading(CalTableId table, int32_t raw);
+
+    // The true value at the current point, from the reference meter. Returns
+    // false if the current point isn't a reference point.
+    bool setReference(int32_t value);
+
+    // Returns true once whenever the output needs setting: after every step
+    // and when the sweep stops.
+    bool takeChange()
+    {
+        bool b = changed;
+        changed = false;
+        return b;
+    }
+
+    bool isRunning()
+    {
+        return state == settling || state == reference;
+    }
+
+    State getState()
+    {
+        return state;
+    }
+
+    CalTableId getOutput()
+    {
+        return output;
+    }
+
+    uint8_t getPoint()
+    {
+        return point;
+    }
+
+    uint8_t getPoints()
+    {
+        return points;
+    }
+
+    // Nominal output at the current point, in milli-units
+    int32_t getSetpoint()
+    {
+        return (int32_t)point * step;
+    }
+
+    // Average raw reading at the last finished point
+    int32_t getReading()
+    {
+        return lastReading;
+    }
+
+private:
+    Persist &persist;
+    const PersistRegion *regions;
+    uint8_t regionCount;
+    Calibration *cal = nullptr;
+    State state = idle;
+    bool changed = false;
+
+    CalTableId output = calVOutput;
+    CalTableId reading = calVReading;
+    uint8_t points = 0;
+    uint16_t step = 0;
+    int16_t tolerance = 0;
+    uint8_t point = 0;
+    int32_t lastReading = 0;
+
+    // Readings at the current point
+    uint16_t count = 0; // Since the step
+    uint8_t filled = 0; // In the two halves
+    int32_t firstHalf = 0;
+    int32_t secondHalf = 0;
+    bool measured = false;
+
+    int16_t raw[CAL_MAX_POINTS];      // Average raw reading at each point
+    const uint8_t *refPoints = nullptr;
+    uint8_t refCount = 0;
+    uint8_t ref = 0;                  // Next reference point
+    bool referenced = false;          // The reference at the current point is in
+    int16_t refTrue[CAL_MAX_REFS];
+
+    bool isRefPoint()
+    {
+        return ref < refCount && refPoints[ref] == point;
+    }
+
+    void next();
+
+    int32_t fit(const int16_t *refRaw, int32_t r);
+
+    void finish();
+};
+#endif
@@ -0,0 +1,50 @@
+#include "Channel.hpp"
+
+uint16_t Channel::toVoltCode(uint32_t mv)
+{
+    return ((uint32_t)dac.maxValue() * cal.toVOutput(mv)) / MAX_MV;
+}
+
+uint16_t Channel::toAmpCode(uint32_t ma)
+{
+    return ((uint32_t)dac.maxValue() * cal.toIOutput(ma)) / MAX_MA;
+}
+
+int32_t Channel::codeToVolt(uint16_t code)
+{
+    return cal.toVReading(ADC_TO_VOLT((int32_t)code));
+}
+
+int32_t Channel::codeToAmp(uint16_t code)
+{
+    return cal.toIReading(ADC_TO_AMP((int32_t)code));
+}
+
+// The lowest ADC code that reads as limit or more, or PROTECT_OFF if even
+// full scale reads lower
+uint16_t Channel::toLimitCode(int32_t limit, int32_t (Channel::*toReading)(uint16_t))
+{
+    uint16_t lo = 0, hi = ADC_MAX_VALUE - 1;
+    if ((this->*toReading)(hi) < limit)
+    {
+        return PROTECT_OFF;
+    }
+    while (lo < hi)
+    {
+        uint16_t mid = (lo + hi) / 2;
+        if ((this->*toReading)(mid) >= limit)
+        {
+            hi = mid;
+        }
+        else
+        {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+void Channel::updateProtection()
+{
+    protection.setLimits(toLimitCode(ovpLimit, &Channel::codeToVolt), toLimitCode(ocpLimit, &Channel::codeToAmp));
+}
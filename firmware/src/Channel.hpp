@@ -0,0 +1,148 @@
+/*
+Copyright 2023, Pontus Rydin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in
+the Software without restriction, including without limitation the rights to use,
+copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __CHANNEL_HPP
+#define __CHANNEL_HPP
+#include "Hal.hpp"
+#include "Calibration.hpp"
+#include "Sampler.hpp"
+#include "Filter.hpp"
+#include "SetpointTrim.hpp"
+#include "Protection.hpp"
+#include "EnergyMeter.hpp"
+
+// ADC constants
+#define ADC_VREF 4096      // ADC reference voltage in millivolts
+#define ADC_MAX_VALUE 4096 // Maximum value returned from ADC (2^bits)
+#define ADC_CURRENT 0      // Curremt channel
+#define ADC_VOLTAGE 1      // Voltage channel
+
+// DAC constants
+#define DAC_VOLTAGE 1      // Voltage channel
+#define DAC_CURRENT 0      // Current channel
+#define DAC_MAX_VALUE 4095 // Maximum value written to DAC
+
+// Filtering
+#define OVERSAMPLE_BITS 2 // Extra bits of resolution for voltage and current
+#define FILTER_WINDOW 32  // Decimated voltage and current readings averaged (256 ms, 512 ms with two channels)
+#define STEP_THRESHOLD 64 // Deviation from the average (in oversampled codes) that counts as a step
+
+// Conversion factors and functions (all values in millivolts and milliamps)
+#define MAX_MV 30000                                                  // Maximum millivolts the supply can output
+#define MAX_MA 2000                                                   // Maximum milliamps the supply can output
+#define ADC_TO_RAW_VOLT(x) ((x * ADC_VREF) / ADC_MAX_VALUE)           // Convert ADC reading to actual volts seen on pin
+#define ADC_TO_VOLT(x) (ADC_TO_RAW_VOLT(x) * (MAX_MV / ADC_VREF))     // Convert ADC reading to volts on supply output
+#define ADC_TO_AMP(x) ((ADC_TO_RAW_VOLT(x) * MAX_MA) / ADC_MAX_VALUE) // Convert ADC reading to amps through load
+
+// Over-voltage and over-current trip. Limits above what the ADC can read turn it off.
+#define OVP_DEFAULT 31000 // Off (mV)
+#define OVP_MAX 31000
+#define OCP_DEFAULT 2200  // Off (mA)
+#define OCP_MAX 2200
+
+// One output board: its MCP3202 and MCP4922, and everything that belongs to
+// that output alone. The calibration, the filters, the trim, the OVP/OCP
+// trip and the charge counter are per board, as no two boards read or drive
+// quite the same. What each output is told to do, and how the outputs track
+// each other, is decided in main.cpp.
+class Channel
+{
+public:
+    Channel(hal::Adc &adc, hal::Dac &dac)
+        : adc(adc), dac(dac), trim(DAC_MAX_VALUE, MAX_MV), voltDecimator(OVERSAMPLE_BITS), ampDecimator(OVERSAMPLE_BITS),
+          measVolt(STEP_THRESHOLD), measAmp(STEP_THRESHOLD)
+    {
+    }
+
+    hal::Adc &adc;
+    hal::Dac &dac;
+    Calibration cal;
+    SetpointTrim trim;
+
+    // Decimated and filtered readings, in oversampled ADC codes
+    Decimator voltDecimator;
+    Decimator ampDecimator;
+    AdaptiveAverage<FILTER_WINDOW> measVolt;
+    AdaptiveAverage<FILTER_WINDOW> measAmp;
+
+    // OVP and OCP, checked in the sampling interrupt
+    OutputProtection protection;
+    int32_t ovpLimit = OVP_DEFAULT; // mV
+    int32_t ocpLimit = OCP_DEFAULT; // mA
+
+    // Charge and energy, summed in the sampling interrupt
+    EnergyMeter meter;
+
+    // Voltage and current set on the dials or remotely (millivolts and milliamps)
+    uint32_t vSet = 0;
+    uint32_t iSet = 0;
+
+    // Output enable (remote control only)
+    bool outputOn = true;
+
+    // Codes last written to the DAC from loop(), which a list starts from
+    uint16_t dacVolt = 0;
+    uint16_t dacAmp = 0;
+
+    // Latest calibrated output current, for the current limit check (milliamps)
+    int32_t calAmpNow = 0;
+
+    uint16_t toVoltCode(uint32_t mv);
+
+    uint16_t toAmpCode(uint32_t ma);
+
+    int32_t codeToVolt(uint16_t code);
+
+    int32_t codeToAmp(uint16_t code);
+
+    // Converts the limits to ADC codes. Call after they or the calibration change.
+    void updateProtection();
+
+    // Loads both DAC channels. They change on the next latch, which may be
+    // shared with other boards.
+    void load(uint16_t volt, uint16_t amp)
+    {
+        dac.load(DAC_VOLTAGE, volt);
+        dac.load(DAC_CURRENT, amp);
+    }
+
+    // Call from the sampling interrupt with the channel's latest pair of
+    // codes. Counts charge and energy and checks the limits, returning true
+    // when one has just tripped. The caller then zeroes the output.
+    bool onSample(uint16_t voltCode, uint16_t ampCode)
+    {
+        if (meter.isRunning())
+        {
+            // Each pair goes through the calibration on its own, as the current table is far from straight.
+            // The current is rounded to mA rather than truncated, so the half LSB doesn't add up.
+            int32_t volt = cal.toVReading(ADC_TO_VOLT((int32_t)voltCode));
+            int32_t amp = cal.toIReading(((int32_t)ampCode * MAX_MA + ADC_MAX_VALUE / 2) / ADC_MAX_VALUE);
+            meter.sample(volt, amp);
+        }
+        return protection.check(voltCode, ampCode);
+    }
+
+private:
+    uint16_t toLimitCode(int32_t limit, int32_t (Channel::*toReading)(uint16_t));
+};
+#endif
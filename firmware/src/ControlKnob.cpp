@@ -1,11 +1,8 @@
-#include <Arduino.h>
 #include "ControlKnob.hpp"
 
 void ControlKnob::tick()
 {
-    knob.tick();
-    // Serial.println(digitalRead(switchPin));
-    if (digitalRead(switchPin) == LOW)
+    if (knob.isPressed())
     {
         if (!pressed)
         {
@@ -31,19 +28,54 @@ void ControlKnob::tick()
     {
         pressed = false;
     }
-    int16_t pos = knob.getPosition();
-    if (pos == currentPos)
+    int8_t delta = knob.takeDetents();
+    if (delta == 0)
     {
         return;
     }
 
     // The knob was moved
-    int16_t delta = pos - currentPos;
-    currentPos = pos;
-    int32_t increment = fast ? fastIncrement : slowIncrement;
-    int32_t newValue = currentValue + delta * increment;
+    if (fast)
+    {
+        int32_t newValue = currentValue + delta * fastIncrement;
+        if (newValue >= minValue && newValue <= maxValue)
+        {
+            currentValue = newValue;
+        }
+        return;
+    }
+    uint8_t factor = getFactor(delta);
+    int32_t newValue = currentValue + (int32_t)delta * slowIncrement * factor;
+    if (factor > 1)
+    {
+        // Spinning fast, so stop at the end rather than ignoring the last turn
+        newValue = min(max(newValue, minValue), maxValue);
+    }
     if (newValue >= minValue && newValue <= maxValue)
     {
         currentValue = newValue;
     }
+}
+
+uint8_t ControlKnob::getFactor(int8_t delta)
+{
+    uint32_t now = hal::millis();
+    int8_t direction = delta > 0 ? 1 : -1;
+    uint32_t elapsed = (now - lastTurn) / (delta * direction);
+    uint16_t interval = elapsed > 0xffff ? 0xffff : elapsed;
+    lastTurn = now;
+
+    // Average over two moves, so one quick pair of detents doesn't set it off.
+    // Turning back always starts over at normal speed.
+    uint16_t average = direction == lastDirection ? (interval + (uint32_t)lastInterval) / 2 : 0xffff;
+    lastInterval = interval;
+    lastDirection = direction;
+    for (uint8_t i = 0; i < accelSteps; i++)
+    {
+        if (average < accel[i].interval)
+        {
+            return accel[i].factor;
+        }
+    }
+    return 1;
 }
\ No newline at end of file
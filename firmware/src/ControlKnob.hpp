@@ -1,13 +1,21 @@
-#include <RotaryEncoder.h>
+#include "Hal.hpp"
 #include "Display.hpp"
+#include "QuadratureEncoder.hpp"
+
+// One step of a knob acceleration curve. Detents that come less than
+// interval ms apart move the value factor times the normal increment.
+struct KnobAcceleration
+{
+    uint16_t interval;
+    uint8_t factor;
+};
 
 class ControlKnob
 {
 public:
-    ControlKnob(RotaryEncoder &knob, Display &display, Display::ID id, int32_t minValue, int32_t maxValue, int16_t slowIncrement, int16_t fastIncrement, int16_t switchPin)
-        : knob(knob), display(display), id(id), minValue(minValue), maxValue(maxValue), slowIncrement(slowIncrement), fastIncrement(fastIncrement), switchPin(switchPin)
+    ControlKnob(QuadratureEncoder &knob, Display &display, Display::ID id, int32_t minValue, int32_t maxValue, int16_t slowIncrement, int16_t fastIncrement)
+        : knob(knob), display(display), id(id), minValue(minValue), maxValue(maxValue), slowIncrement(slowIncrement), fastIncrement(fastIncrement)
     {
-        pinMode(switchPin, INPUT_PULLUP);
     }
 
     void tick();
@@ -17,6 +25,28 @@ public:
         return currentValue;
     }
 
+    // Sets the value as if the knob had been turned to it. Returns false if
+    // the value is out of range.
+    bool setValue(int32_t v)
+    {
+        if (v < minValue || v > maxValue)
+        {
+            return false;
+        }
+        currentValue = v;
+        return true;
+    }
+
+    // Changes the upper end of the range, pulling the value down into it
+    void setMaxValue(int32_t v)
+    {
+        maxValue = v;
+        if (currentValue > maxValue)
+        {
+            currentValue = maxValue;
+        }
+    }
+
     bool isFast()
     {
         return fast;
@@ -27,19 +57,32 @@ public:
         peer = p;
     }
 
+    // Sets the acceleration curve used in fine mode, ordered by increasing
+    // interval. The table must outlive the knob.
+    void setAcceleration(const KnobAcceleration *curve, uint8_t n)
+    {
+        accel = curve;
+        accelSteps = n;
+    }
+
 private:
     ControlKnob *peer;
-    RotaryEncoder &knob;
+    QuadratureEncoder &knob;
     Display &display;
     int32_t minValue;
     int32_t maxValue;
     int16_t slowIncrement;
     int16_t fastIncrement;
-    int16_t switchPin;
 
-    int16_t currentPos = 0;
+    const KnobAcceleration *accel = nullptr;
+    uint8_t accelSteps = 0;
+    uint32_t lastTurn = 0;      // When the knob last moved (ms)
+    uint16_t lastInterval = 0;  // Time per detent at the last move (ms)
+    int8_t lastDirection = 0;
     bool fast = false;
     bool pressed = false;
     int32_t currentValue = 0;
     Display::ID id;
+
+    uint8_t getFactor(int8_t delta);
 };
\ No newline at end of file
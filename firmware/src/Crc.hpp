@@ -0,0 +1,56 @@
+/*
+Copyright 2023, Pontus Rydin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in
+the Software without restriction, including without limitation the rights to use,
+copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef __CRC_HPP
+#define __CRC_HPP
+#include <stdint.h>
+#ifdef __AVR__
+#include <util/crc16.h>
+#endif
+
+// CRC-8 with polynomial 0x07, initial value 0
+inline uint8_t crc8Update(uint8_t crc, uint8_t b)
+{
+#ifdef __AVR__
+    return _crc8_ccitt_update(crc, b);
+#else
+    crc ^= b;
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+    return crc;
+#endif
+}
+
+// CRC-16/CCITT (polynomial 0x1021, reflected, as in avr-libc's _crc_ccitt_update)
+inline uint16_t crc16Update(uint16_t crc, uint8_t b)
+{
+#ifdef __AVR__
+    return _crc_ccitt_update(crc, b);
+#else
+    b ^= crc & 0xff;
+    b ^= b << 4;
+    return ((((uint16_t)b << 8) | (crc >> 8)) ^ (uint8_t)(b >> 4) ^ ((uint16_t)b << 3));
+#endif
+}
+#endif
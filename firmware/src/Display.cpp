@@ -1,5 +1,17 @@
 #include "Display.hpp"
 
+#define DISPLAY_CELLS (DISPLAY_COLS * DISPLAY_ROWS)
+
+static const uint8_t lockChar[8] PROGMEM = {
+    0b00100,
+    0b01010,
+    0b10001,
+    0b11111,
+    0b10001,
+    0b10101,
+    0b11111,
+    0b00000};
+
 Display::Display() : lcd(0x27, 20, 4)
 {
 }
@@ -7,63 +19,145 @@ Display::Display() : lcd(0x27, 20, 4)
 void Display::init()
 {
     lcd.init();
-    lcd.createChar(0, lockChar);
+    char glyph[sizeof(lockChar)];
+    for (uint8_t i = 0; i < sizeof(glyph); i++)
+    {
+        glyph[i] = hal::readFlashByte(lockChar + i);
+    }
+    lcd.createChar(0, glyph);
     lcd.backlight();
+    lcd.clear();
+    memset(glass, ' ', sizeof(glass));
+    lcdPos = 0;
     normal();
 }
 
 void Display::normal()
 {
-    lcd.clear();
     /// Draw an initial display like this:
     // V= 0.01V ->  0.00V
     // I= 1.23A ->  1.11A
     // T= 23.0°C    P=55.5W
     // FAN=1234RPM
-    lcd.setCursor(0, 0);
-    lcd.print("V=  0.00V ->   0.00V");
-    lcd.setCursor(0, 1);
-    lcd.print("I=  0.00A ->   0.00A");
-    lcd.setCursor(0, 2);
-    lcd.print("T= ----\xdf\x43  P= --.--W");
-    lcd.setCursor(0, 3);
-    lcd.print("FAN  ---RPM");
+    mode = normalMode;
+    put(0, 0, F("V=  0.00V ->   0.00V"));
+    put(0, 1, F("I=  0.00A ->   0.00A"));
+    put(0, 2, F("T= ----\xdf\x43  P= --.--W"));
+    put(0, 3, F("FAN  ---RPM         "));
+    setLockedMode(locked);
+    changed = 0xffff;
 }
 
 void Display::setLockedMode(bool locked)
 {
+    this->locked = locked;
+    if (mode != normalMode)
+    {
+        return;
+    }
     if (locked)
     {
-        lcd.setCursor(10, 0);
-        lcd.print("LCK");
-        lcd.setCursor(10, 1);
-        lcd.print("LCK");
+        put(10, 0, F("LCK"));
+        put(10, 1, F("LCK"));
     }
     else
     {
-        lcd.setCursor(10, 0);
-        lcd.print("-> ");
-        lcd.setCursor(10, 1);
-        lcd.print("-> ");
+        put(10, 0, list ? F("LST") : F("-> "));
+        put(10, 1, derated ? F("DRT") : F("-> "));
+    }
+}
+
+void Display::setDerated(bool derated)
+{
+    if (derated != this->derated)
+    {
+        this->derated = derated;
+        setLockedMode(locked);
+    }
+}
+
+void Display::setList(bool list)
+{
+    if (list != this->list)
+    {
+        this->list = list;
+        setLockedMode(locked);
     }
 }
 
 void Display::overtemp()
 {
-    lcd.clear();
     /// Draw an initial display like this:
     // *** OVERTEMP! ***
     // Allow to cool off!
     // T= 23.0°C    P=55.5W
     // FAN=1234RPM
-    lcd.setCursor(0, 0);
-    lcd.print("*** OVERTEMP! ***");
-    lcd.setCursor(0, 1);
-    lcd.print("Allow to cool off!");
-    lcd.setCursor(0, 2);
-    lcd.print("T= ----\xdf\x43");
-    lcd.setCursor(0, 3);
-    lcd.print("FAN  ---RPM");
+    mode = overtempMode;
+    put(0, 0, F("*** OVERTEMP! ***   "));
+    put(0, 1, F("Allow to cool off!  "));
+    put(0, 2, F("T= ----\xdf\x43           "));
+    put(0, 3, F("FAN  ---RPM         "));
+    changed = TEMP_CHANGED | RPM_CHANGED;
+}
+
+void Display::tripped(bool overVoltage)
+{
+    /// Draw an initial display like this:
+    // *** OVP TRIPPED ***
+    // Cycle lock to clear
+    // T= 23.0°C    P=55.5W
+    // FAN=1234RPM
+    mode = trippedMode;
+    put(0, 0, overVoltage ? F("*** OVP TRIPPED *** ") : F("*** OCP TRIPPED *** "));
+    put(0, 1, F("Cycle lock to clear "));
+    put(0, 2, F("T= ----\xdf\x43           "));
+    put(0, 3, F("FAN  ---RPM         "));
+    changed = TEMP_CHANGED | RPM_CHANGED;
+}
+
+void Display::textPage(Mode m)
+{
+    mode = m;
+    for (uint8_t y = 0; y < DISPLAY_ROWS; y++)
+    {
+        put(0, y, F("                    "));
+    }
+    changed = 0;
+}
+
+void Display::calibration()
+{
+    textPage(calMode);
+}
+
+void Display::energy()
+{
+    textPage(energyMode);
+}
+
+#ifdef PROFILE
+void Display::diagnostics()
+{
+    textPage(diagMode);
+}
+#endif
+
+void Display::setTextRow(uint8_t row, const char *s)
+{
+    if (isTextPage() && row < DISPLAY_ROWS)
+    {
+        put(0, row, F("                    "));
+        put(0, row, s);
+    }
+}
+
+void Display::setTextRow(uint8_t row, const hal::FlashString *s)
+{
+    if (isTextPage() && row < DISPLAY_ROWS)
+    {
+        put(0, row, F("                    "));
+        put(0, row, s);
+    }
 }
 
 void Display::setISet(int32_t v)
@@ -137,47 +231,126 @@ void Display::setRpm(int32_t v)
     changed |= RPM_CHANGED;
 }
 
-void Display::refresh()
+void Display::setFanStalled(bool stalled)
 {
-    if (changed && cursorActive)
-    {
-        lcd.noCursor();
-    }
-    if (changed & VSET_CHANGED)
+    if (stalled == fanStalled)
     {
-        printReading(3, 0, vSet);
+        return;
     }
-    if (changed & VACT_CHANGED)
+    fanStalled = stalled;
+    changed |= RPM_CHANGED;
+}
+
+void Display::setChannel(uint8_t channel, const hal::FlashString *tracking)
+{
+    if (channel == this->channel && tracking == this->tracking)
     {
-        printReading(14, 0, vAct);
+        return;
     }
+    this->channel = channel;
+    this->tracking = tracking;
+    changed |= CHANNEL_CHANGED;
+}
 
-    if (changed & ISET_CHANGED)
+void Display::refresh()
+{
+    PROFILE_SCOPE(profileDisplay);
+    // Render changed fields into the frame. This never touches the LCD.
+    if (mode == normalMode)
     {
-        printReading(3, 1, iSet);
+        if (changed & VSET_CHANGED)
+        {
+            printReading(3, 0, vSet);
+        }
+        if (changed & VACT_CHANGED)
+        {
+            printReading(14, 0, vAct);
+        }
+        if (changed & ISET_CHANGED)
+        {
+            printReading(3, 1, iSet);
+        }
+        if (changed & IACT_CHANGED)
+        {
+            printReading(14, 1, iAct);
+        }
+        if (changed & PACT_CHANGED)
+        {
+            printReading(14, 2, pAct);
+        }
+#if NUM_CHANNELS > 1
+        if (changed & CHANNEL_CHANGED)
+        {
+            // FAN  ---RPM  CH1 SER
+            put(13, 3, F("CH"));
+            printInt(15, 3, channel + 1, 1);
+            put(17, 3, tracking ? tracking : F("   "));
+        }
+#endif
     }
-    if (changed & IACT_CHANGED)
+    if (isTextPage())
     {
-        printReading(14, 1, iAct);
+        // Text rows go straight into the frame
+        changed = 0;
     }
     if (changed & TEMP_CHANGED)
     {
-        printInt(3, 2, temp, 5);
+        printInt(3, 2, temp, 4);
     }
-    if (changed & PACT_CHANGED)
+    if (changed & RPM_CHANGED)
     {
-        printReading(14, 2, pAct);
+        if (fanStalled)
+        {
+            put(4, 3, F("STALL  "));
+        }
+        else
+        {
+            printInt(4, 3, rpm, 4);
+            put(8, 3, F("RPM"));
+        }
     }
-    if (changed & RPM_CHANGED)
+    changed = 0;
+    flush();
+}
+
+void Display::flush()
+{
+    // Send at most DISPLAY_FLUSH_BYTES of differences, picking up where the
+    // last flush stopped so every part of the display gets its turn.
+    uint8_t budget = DISPLAY_FLUSH_BYTES;
+    bool sent = false;
+    for (uint8_t i = 0; i < DISPLAY_CELLS && budget > 0; i++)
     {
-        printInt(4, 3, rpm, 4);
+        uint8_t pos = flushPos;
+        uint8_t y = pos / DISPLAY_COLS;
+        uint8_t x = pos % DISPLAY_COLS;
+        if (frame[y][x] != glass[y][x])
+        {
+            if (lcdPos != pos)
+            {
+                // Moving the cursor costs a byte of its own
+                if (budget < 2)
+                {
+                    break;
+                }
+                lcd.setCursor(x, y);
+                budget--;
+            }
+            lcd.write(frame[y][x]);
+            glass[y][x] = frame[y][x];
+            budget--;
+            sent = true;
+
+            // The LCD doesn't wrap to the next row on screen, so the position is unknown past the end
+            lcdPos = x < DISPLAY_COLS - 1 ? pos + 1 : 0xff;
+        }
+        flushPos = pos < DISPLAY_CELLS - 1 ? pos + 1 : 0;
     }
-    if (changed && cursorActive)
+    if (sent && cursorActive)
     {
         lcd.setCursor(cursorX, cursorY);
-        lcd.cursor();
+        lcdPos = 0xff;
     }
-    changed = 0;
 }
 
 void Display::setCoarseMode(ID id, bool b)
@@ -205,26 +378,100 @@ void Display::setCoarseMode(ID id, bool b)
         lcd.noBlink();
         cursorActive = false;
     }
+    lcdPos = 0xff;
+}
+
+void Display::put(int x, int y, const char *s)
+{
+    while (*s && x < DISPLAY_COLS)
+    {
+        frame[y][x++] = *s++;
+    }
+}
+
+void Display::put(int x, int y, const hal::FlashString *s)
+{
+    for (uint8_t i = 0; x < DISPLAY_COLS; i++)
+    {
+        char c = hal::readFlashChar(s, i);
+        if (!c)
+        {
+            break;
+        }
+        frame[y][x++] = c;
+    }
 }
 
 void Display::printReading(int x, int y, uint32_t r)
 {
-    // r is in milli-units
-    lcd.setCursor(x, y);
-    if (r > 99000.0 || r < 0)
+    // r is in milli-units, shown to two decimals with halves rounded up
+    if (r > 99000)
     {
-        lcd.print("--.--");
+        put(x, y, F("--.--"));
     }
     else
     {
-        dtostrf((float)r / 1000.0, 5, 2, convBuf);
-        lcd.print(convBuf);
+        printFixed(x, y, (r + 5) / 10, 5, 2);
     }
 }
 
 void Display::printInt(int x, int y, int r, int size)
 {
-    lcd.setCursor(x, y);
-    dtostrf(r, size, 0, convBuf);
-    lcd.print(convBuf);
+    printFixed(x, y, r, size, 0);
+}
+
+void Display::printFixed(int x, int y, int32_t v, uint8_t width, uint8_t decimals)
+{
+    uint32_t u = v < 0 ? -(uint32_t)v : v;
+    uint8_t digits = 1;
+    for (uint32_t t = u / 10; t; t /= 10)
+    {
+        digits++;
+    }
+    if (digits <= decimals)
+    {
+        digits = decimals + 1; // Leading zero
+    }
+    uint8_t len = digits + (decimals ? 1 : 0) + (v < 0 ? 1 : 0);
+    if (x + width > DISPLAY_COLS)
+    {
+        return;
+    }
+
+    char *p = &frame[y][x + width];
+    if (len > width)
+    {
+        while (p > &frame[y][x])
+        {
+            *--p = '-';
+        }
+        if (decimals)
+        {
+            frame[y][x + width - decimals - 1] = '.';
+        }
+        return;
+    }
+    // Right to left, then pad
+    for (uint8_t i = 0; i < decimals; i++)
+    {
+        *--p = '0' + u % 10;
+        u /= 10;
+    }
+    if (decimals)
+    {
+        *--p = '.';
+    }
+    do
+    {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (v < 0)
+    {
+        *--p = '-';
+    }
+    while (p > &frame[y][x])
+    {
+        *--p = ' ';
+    }
 }
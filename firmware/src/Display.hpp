@@ -23,8 +23,8 @@ OTHER DEALINGS IN THE SOFTWARE.
 
 #ifndef __DISPLAY_HPP
 #define __DISPLAY_HPP
-#include <Arduino.h>
-#include <LiquidCrystal_I2C.h>
+#include "Hal.hpp"
+#include "Profile.hpp"
 
 // Bits in the change bitmap
 #define ISET_CHANGED 1
@@ -34,6 +34,11 @@ OTHER DEALINGS IN THE SOFTWARE.
 #define TEMP_CHANGED 16
 #define PACT_CHANGED 32
 #define RPM_CHANGED 64
+#define CHANNEL_CHANGED 128
+
+#define DISPLAY_COLS 20
+#define DISPLAY_ROWS 4
+#define DISPLAY_FLUSH_BYTES 4 // Maximum bytes sent to the LCD per call to refresh()
 
 class Display
 {
@@ -44,16 +49,6 @@ public:
         current
     };
 
-    const char lockChar[8] = {
-        0b00100,
-        0b01010,
-        0b10001,
-        0b11111,
-        0b10001,
-        0b10101,
-        0b11111,
-        0b00000};
-
     Display();
 
     void init();
@@ -62,6 +57,9 @@ public:
 
     void overtemp();
 
+    // Page shown while OVP or OCP has tripped. Left with normal().
+    void tripped(bool overVoltage);
+
     void setISet(int32_t v);
 
     void setIAct(int32_t v);
@@ -76,23 +74,116 @@ public:
 
     void setRpm(int32_t v);
 
+    // Shows STALL in place of the fan speed while the fan is stalled
+    void setFanStalled(bool stalled);
+
+    // Shows which output the dials act on, and the tracking mode if any
+    // (nullptr for none), at the end of the fan row. Only drawn when built
+    // for more than one channel.
+    void setChannel(uint8_t channel, const hal::FlashString *tracking);
+
     void setCoarseMode(ID id, bool b);
 
     void refresh();
 
     void setLockedMode(bool locked);
 
+    // Shows DRT in place of the arrow on the current row while the current
+    // limit is being derated. The lock indication takes precedence.
+    void setDerated(bool derated);
+
+    // Shows LST in place of the arrow on the voltage row while a list owns
+    // the output. The lock indication takes precedence.
+    void setList(bool list);
+
+    // Page with free-form rows showing a calibration sweep. Left with normal().
+    void calibration();
+
+    bool isCalibration()
+    {
+        return mode == calMode;
+    }
+
+    // Page with free-form rows showing the charge and energy counters. Left with normal().
+    void energy();
+
+    bool isEnergy()
+    {
+        return mode == energyMode;
+    }
+
+#ifdef PROFILE
+    // Hidden page with free-form rows of diagnostics. Left with normal().
+    void diagnostics();
+
+    bool isDiagnostics()
+    {
+        return mode == diagMode;
+    }
+#endif
+
+    // Replaces a row of the calibration, energy or diagnostics page
+    void setTextRow(uint8_t row, const char *s);
+
+    void setTextRow(uint8_t row, const hal::FlashString *s);
+
 private:
-    LiquidCrystal_I2C lcd;
+    enum Mode
+    {
+        normalMode,
+        overtempMode,
+        trippedMode,
+        calMode,
+        energyMode,
+#ifdef PROFILE
+        diagMode
+#endif
+    };
+
+    hal::Lcd lcd;
+    Mode mode = normalMode;
+    bool locked = false;
+    bool derated = false;
+    bool list = false;
+    bool fanStalled = false;
     uint16_t changed = 0xffff; // Update everything on init
     int32_t vSet = 0.0, vAct = 0.0, iSet = 0.0, iAct = 0.0, temp = 0.0, pAct = 0.0, rpm = 0;
-    char convBuf[100]; // Buffer used during number to string conversions
+    uint8_t channel = 0;
+    const hal::FlashString *tracking = nullptr;
     uint8_t cursorX;
     uint8_t cursorY;
     bool cursorActive;
 
+    // What we want on the display and what we know is on it. refresh() sends
+    // the difference a few bytes at a time.
+    char frame[DISPLAY_ROWS][DISPLAY_COLS];
+    char glass[DISPLAY_ROWS][DISPLAY_COLS];
+    uint8_t flushPos = 0;   // Where the next flush starts looking for differences
+    uint8_t lcdPos = 0xff;  // Where the LCD will put the next character, 0xff if unknown
+
+    void put(int x, int y, const char *s);
+
+    void put(int x, int y, const hal::FlashString *s);
+
+    void textPage(Mode m);
+
+    bool isTextPage()
+    {
+#ifdef PROFILE
+        return mode == calMode || mode == energyMode || mode == diagMode;
+#else
+        return mode == calMode || mode == energyMode;
+#endif
+    }
+
+    void flush();
+
     void printReading(int x, int y, uint32_t r);
 
     void printInt(int x, int y, int r, int size);
+
+    // Writes v, scaled down by 10^decimals, right aligned in width columns
+    // of the frame, or dashes if it doesn't fit. No floating point.
+    void printFixed(int x, int y, int32_t v, uint8_t width, uint8_t decimals);
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,94 @@
+/*
+Copyright 2023, Pontus Rydin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in
+the Software without restriction, including without limitation the rights to use,
+copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef __ENERGY_METER_HPP
+#define __ENERGY_METER_HPP
+#include "Hal.hpp"
+
+// Charge, energy and on-time, as of one moment
+struct EnergyTotals
+{
+    uint64_t ticks; // Sample ticks counted
+    int64_t charge; // mA per tick
+    int64_t energy; // uW (mV * mA) per tick
+};
+
+// Charge and energy counters. Every calibrated voltage/current sample pair
+// is added in the sampling interrupt, so nothing between samples of the
+// filtered readings is lost and queue overruns don't matter. The totals are
+// fixed point in sample ticks. At 2 kHz and full output they overflow after
+// thousands of years.
+class EnergyMeter
+{
+public:
+    // Call from the sampling interrupt with every pair while isRunning()
+    void sample(int32_t mv, int32_t ma)
+    {
+        totals.ticks++;
+        totals.charge += ma;
+        totals.energy += mv * ma;
+    }
+
+    bool isRunning()
+    {
+        return running;
+    }
+
+    // Counts while on (the output is live) and not held
+    void setOn(bool on)
+    {
+        this->on = on;
+        running = on && !held;
+    }
+
+    void setHeld(bool held)
+    {
+        this->held = held;
+        running = on && !held;
+    }
+
+    bool isHeld()
+    {
+        return held;
+    }
+
+    void read(EnergyTotals &t)
+    {
+        uint8_t state = hal::disableInterrupts();
+        t = totals;
+        hal::restoreInterrupts(state);
+    }
+
+    void reset()
+    {
+        uint8_t state = hal::disableInterrupts();
+        totals = EnergyTotals();
+        hal::restoreInterrupts(state);
+    }
+
+private:
+    EnergyTotals totals = EnergyTotals();
+    volatile bool running = false;
+    bool on = false;
+    bool held = false;
+};
+#endif
@@ -0,0 +1,190 @@
+/*
+Copyright 2023, Pontus Rydin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in
+the Software without restriction, including without limitation the rights to use,
+copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef __FILTER_HPP
+#define __FILTER_HPP
+#include "Hal.hpp"
+
+// Moving average over the last N samples. Updating is O(1) regardless of N,
+// since the sum is kept running. N must be a power of two so the average is
+// a shift once the window is full.
+template <class T, uint8_t N>
+class MovingAverage
+{
+public:
+    void update(T v)
+    {
+        sum += (int32_t)v - buf[pos];
+        buf[pos] = v;
+        pos = (pos + 1) & (N - 1);
+        if (count < N)
+        {
+            count++;
+        }
+    }
+
+    // Forgets the history, as if every sample in the window had been v
+    void reset(T v)
+    {
+        for (uint8_t i = 0; i < N; i++)
+        {
+            buf[i] = v;
+        }
+        sum = (int32_t)v * N;
+        count = N;
+    }
+
+    T get()
+    {
+        if (count == N)
+        {
+            return sum / N;
+        }
+        return count ? sum / count : 0;
+    }
+
+    bool isFull()
+    {
+        return count == N;
+    }
+
+private:
+    T buf[N] = {};
+    uint8_t pos = 0;
+    uint8_t count = 0;
+    int32_t sum = 0;
+};
+
+// First order low pass, y += (x - y) / 2^k, with 8 fractional bits of state.
+// The time constant is roughly 2^k samples. Needs no history at all.
+class ExpFilter
+{
+public:
+    ExpFilter(uint8_t k) : k(k)
+    {
+    }
+
+    void update(int16_t v)
+    {
+        int32_t x = (int32_t)v << 8;
+        if (!primed)
+        {
+            state = x;
+            primed = true;
+            return;
+        }
+        state += (x - state) >> k;
+    }
+
+    int16_t get()
+    {
+        return (state + 128) >> 8;
+    }
+
+private:
+    uint8_t k;
+    bool primed = false;
+    int32_t state = 0;
+};
+
+// Median of the last N samples (N odd and small). Rejects spikes shorter
+// than N / 2 + 1 samples at the cost of N / 2 samples of delay.
+template <class T, uint8_t N>
+class MedianFilter
+{
+public:
+    T update(T v)
+    {
+        buf[pos] = v;
+        pos = pos < N - 1 ? pos + 1 : 0;
+        if (count < N)
+        {
+            count++;
+        }
+
+        // Insertion sort of a copy. Cheap for the handful of samples we keep.
+        T sorted[N];
+        for (uint8_t i = 0; i < count; i++)
+        {
+            T x = buf[i];
+            uint8_t j = i;
+            for (; j > 0 && sorted[j - 1] > x; j--)
+            {
+                sorted[j] = sorted[j - 1];
+            }
+            sorted[j] = x;
+        }
+        return sorted[count / 2];
+    }
+
+private:
+    T buf[N] = {};
+    uint8_t pos = 0;
+    uint8_t count = 0;
+};
+
+// Spike rejecting moving average that restarts its window on a step. When
+// STEP_CONFIRM samples in a row deviate from the average by more than the
+// threshold, the input has moved and the old window is discarded, so the
+// output settles in a few samples instead of a full window.
+#define STEP_CONFIRM 2
+
+template <uint8_t N>
+class AdaptiveAverage
+{
+public:
+    AdaptiveAverage(uint16_t threshold) : threshold(threshold)
+    {
+    }
+
+    void update(uint16_t v)
+    {
+        uint16_t m = median.update(v);
+        int32_t deviation = (int32_t)m - avg.get();
+        if (avg.isFull() && (deviation > threshold || deviation < -(int32_t)threshold))
+        {
+            if (++outliers >= STEP_CONFIRM)
+            {
+                avg.reset(m);
+                outliers = 0;
+                return;
+            }
+        }
+        else
+        {
+            outliers = 0;
+        }
+        avg.update(m);
+    }
+
+    uint16_t get()
+    {
+        return avg.get();
+    }
+
+private:
+    uint16_t threshold;
+    uint8_t outliers = 0;
+    MedianFilter<uint16_t, 3> median;
+    MovingAverage<uint16_t, N> avg;
+};
+#endif
@@ -0,0 +1,323 @@
+/*
+Copyright 2023, Pontus Rydin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in
+the Software without restriction, including without limitation the rights to use,
+copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+// Thin hardware abstraction layer. Everything in the firmware that touches
+// a pin, a bus or a peripheral goes through here, so the same code can run
+// on the ItsyBitsy and in the native simulator (see native/Sim.cpp).
+//
+// On the target, almost everything below is a typedef or an inline forward
+// to the Arduino core and the device libraries, so the HAL costs nothing.
+// The exception is the SPI devices, which have their own drivers in
+// HalArduino.cpp so all of them go through one bus discipline.
+
+#ifndef __HAL_HPP
+#define __HAL_HPP
+
+// Output boards wired to this controller, each with its own MCP3202 and
+// MCP4922 (see Channel.hpp). Build with -DNUM_CHANNELS=2 for a dual supply.
+#ifndef NUM_CHANNELS
+#define NUM_CHANNELS 1
+#endif
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <SPI.h>
+#include <LiquidCrystal_I2C.h>
+#include <avr/eeprom.h>
+
+#define HAL_EEPROM_SIZE (E2END + 1)
+#define HAL_NO_PIN 0xff
+
+#define ADC_SPI_CLOCK 1800000 // MCP3202 maximum at 5 V. The 32u4's divider makes it 1 MHz.
+#define DAC_SPI_CLOCK 8000000 // MCP4922 takes 20 MHz, the 32u4 can do 8
+
+namespace hal
+{
+    // A device on the shared SPI bus. A transfer runs between select() and
+    // deselect() with interrupts off, at the device's own clock. That is
+    // all the arbitration the bus needs: the sampling interrupt can't cut
+    // into a transfer from loop(), and loop() can't run during one from the
+    // interrupt. Transfers take a few microseconds, so this costs less than
+    // any lock would. Chip selects go through the port registers, as
+    // digitalWrite() would take longer than the transfer.
+    class SpiDevice
+    {
+    protected:
+        void beginDevice(uint8_t csPin, uint32_t clock);
+
+        uint8_t select();
+
+        void deselect(uint8_t state);
+
+    private:
+        SPISettings settings;
+        volatile uint8_t *csPort = nullptr;
+        uint8_t csMask = 0;
+    };
+
+    // MCP3202 dual channel 12 bit ADC
+    class Adc : public SpiDevice
+    {
+    public:
+        Adc(uint8_t csPin) : csPin(csPin)
+        {
+        }
+
+        void begin();
+
+        uint16_t readChannel(uint8_t channel);
+
+    private:
+        uint8_t csPin;
+    };
+
+    // MCP4922 dual 12 bit DAC. load() writes the input register of a
+    // channel, and latch() moves both input registers to the outputs at the
+    // same instant by pulsing LDAC. Without an LDAC pin (HAL_NO_PIN, with
+    // LDAC tied low), each channel changes as it is loaded.
+    class Dac : public SpiDevice
+    {
+    public:
+        void begin(uint8_t csPin, uint8_t ldacPin);
+
+        uint16_t maxValue()
+        {
+            return 4095;
+        }
+
+        void load(uint8_t channel, uint16_t value);
+
+        void latch();
+
+    private:
+        volatile uint8_t *ldacPort = nullptr;
+        uint8_t ldacMask = 0;
+    };
+
+    typedef LiquidCrystal_I2C Lcd;
+
+    inline void setPinMode(uint8_t pin, uint8_t mode)
+    {
+        pinMode(pin, mode);
+    }
+
+    inline uint8_t readPin(uint8_t pin)
+    {
+        return digitalRead(pin);
+    }
+
+    inline void writePin(uint8_t pin, uint8_t value)
+    {
+        digitalWrite(pin, value);
+    }
+
+    // Port (B = 0 to F = 4) and bit of each digital pin of the 32u4, in the
+    // Leonardo numbering the ItsyBitsy variant uses.
+    constexpr uint8_t PIN_PORTS[] = {2, 2, 2, 2, 2, 1, 2, 3, 0, 0, 0, 0, 2, 1, 0, 0,
+                                     0, 0, 4, 4, 4, 4, 4, 4, 2, 2, 0, 0, 0, 2, 2};
+    constexpr uint8_t PIN_BITS[] = {2, 3, 1, 0, 4, 6, 7, 6, 4, 5, 6, 7, 6, 7, 3, 1,
+                                    2, 0, 7, 6, 5, 4, 1, 0, 4, 7, 4, 5, 6, 6, 5};
+
+    // A pin known at compile time. digitalRead() and digitalWrite() look the
+    // port and bit up in flash and check for a PWM timer on every call; here
+    // both are constants, so read() is a single sbic or in and write() a
+    // single sbi or cbi, which can't be torn by an interrupt either.
+    template <uint8_t pin>
+    class Pin
+    {
+        static_assert(pin < sizeof(PIN_PORTS), "not a digital pin of the 32u4");
+
+        // Data space address of PINx. DDRx and PORTx follow it, and the ports
+        // are three bytes apart from PINB at 0x23.
+        static const uint8_t pinAddr = 0x23 + 3 * PIN_PORTS[pin];
+        static const uint8_t mask = 1 << PIN_BITS[pin];
+
+    public:
+        static void setMode(uint8_t mode)
+        {
+            pinMode(pin, mode);
+        }
+
+        static uint8_t read()
+        {
+            return (_SFR_MEM8(pinAddr) & mask) ? HIGH : LOW;
+        }
+
+        static void write(uint8_t value)
+        {
+            if (value)
+            {
+                _SFR_MEM8(pinAddr + 2) |= mask;
+            }
+            else
+            {
+                _SFR_MEM8(pinAddr + 2) &= ~mask;
+            }
+        }
+    };
+
+    inline void writePwm(uint8_t pin, uint8_t duty)
+    {
+        analogWrite(pin, duty);
+    }
+
+    // Starts a conversion of the internal ADC on an analog pin and returns
+    // without waiting for it, unlike analogRead(), which busy-waits ~104 us.
+    void startAnalog(uint8_t pin);
+
+    inline bool analogReady()
+    {
+        return !(ADCSRA & (1 << ADSC));
+    }
+
+    // The result of the last conversion. Only valid once analogReady().
+    inline int readAnalogResult()
+    {
+        return ADC;
+    }
+
+    // Constant data lives in flash, as the 32u4 has only 2.5 KB of RAM.
+    // Tables are placed there with PROGMEM and strings with F() (typed, for
+    // print-like calls) or PSTR() (for the avr-libc _P functions). Neither
+    // can be read through a plain pointer, only with these.
+    typedef __FlashStringHelper FlashString;
+
+    inline int16_t readFlashWord(const int16_t *p)
+    {
+        return pgm_read_word(p);
+    }
+
+    inline uint8_t readFlashByte(const uint8_t *p)
+    {
+        return pgm_read_byte(p);
+    }
+
+    inline char readFlashChar(const FlashString *s, uint8_t i)
+    {
+        return pgm_read_byte((const char *)s + i);
+    }
+
+    // Bytes of stack that have never been used since paintStack()
+    uint16_t stackHeadroom();
+
+    // Fills the free RAM between the heap and the stack with a pattern that
+    // stackHeadroom() looks for. Call first thing in setup().
+    void paintStack();
+
+    inline uint32_t micros()
+    {
+        return ::micros();
+    }
+
+    // Called when loop() has nothing to do for the next us microseconds.
+    // The target just polls again; the simulator skips ahead.
+    inline void idle(uint32_t us)
+    {
+    }
+
+    inline uint32_t millis()
+    {
+        return ::millis();
+    }
+
+    inline void serialBegin(uint32_t baud)
+    {
+        Serial.begin(baud);
+    }
+
+    inline void serialPrint(const char *s)
+    {
+        Serial.print(s);
+    }
+
+    inline int serialAvailable()
+    {
+        return Serial.available();
+    }
+
+    inline int serialRead()
+    {
+        return Serial.read();
+    }
+
+    inline int serialAvailableForWrite()
+    {
+        return Serial.availableForWrite();
+    }
+
+    inline void serialWrite(const uint8_t *buf, size_t n)
+    {
+        Serial.write(buf, n);
+    }
+
+    inline void spiBegin()
+    {
+        SPI.begin();
+    }
+
+    // Calls callback from an interrupt on the given edge (RISING, FALLING or CHANGE).
+    inline void attachPinInterrupt(uint8_t pin, void (*callback)(), uint8_t mode)
+    {
+        attachInterrupt(digitalPinToInterrupt(pin), callback, mode);
+    }
+
+    // Disables interrupts, returning the previous state for restoreInterrupts().
+    inline uint8_t disableInterrupts()
+    {
+        uint8_t sreg = SREG;
+        noInterrupts();
+        return sreg;
+    }
+
+    inline void restoreInterrupts(uint8_t state)
+    {
+        SREG = state;
+    }
+
+    // Waits for any write in progress, so avoid reading while eepromReady() is false
+    inline uint8_t eepromRead(uint16_t addr)
+    {
+        return eeprom_read_byte((const uint8_t *)addr);
+    }
+
+    // True when the EEPROM can take another write without blocking
+    inline bool eepromReady()
+    {
+        return eeprom_is_ready();
+    }
+
+    // Starts writing a byte, which takes about 3.3 ms. Only call when eepromReady().
+    inline void eepromWrite(uint16_t addr, uint8_t value)
+    {
+        eeprom_write_byte((uint8_t *)addr, value);
+    }
+
+    // Calls callback from a timer interrupt every intervalUs microseconds.
+    void startTimer(uint32_t intervalUs, void (*callback)());
+}
+#else
+#include "native/SimCore.hpp"
+#include "native/SimDevices.hpp"
+#endif
+
+#endif
@@ -0,0 +1,132 @@
+#include "Hal.hpp"
+#define USE_TIMER_3 true
+#include <TimerInterrupt.h>
+#include <ISR_Timer.h>
+
+void hal::startTimer(uint32_t intervalUs, void (*callback)())
+{
+    ITimer3.init();
+    ITimer3.attachInterrupt(1000000.0 / intervalUs, callback);
+}
+
+void hal::startAnalog(uint8_t pin)
+{
+    // Same channel selection as analogRead() on the 32u4, which has MUX5 in ADCSRB
+    if (pin >= A0)
+    {
+        pin -= A0;
+    }
+    uint8_t channel = analogPinToChannel(pin);
+    ADCSRB = (ADCSRB & ~(1 << MUX5)) | (((channel >> 3) & 0x01) << MUX5);
+    ADMUX = (DEFAULT << 6) | (channel & 0x07);
+    ADCSRA |= (1 << ADSC);
+}
+
+// Free RAM starts where the heap ends, or after .bss while nothing is allocated
+extern uint8_t __heap_start;
+extern uint8_t *__brkval;
+
+#define STACK_PAINT 0xa5
+#define STACK_PAINT_MARGIN 16 // Bytes below the current stack pointer left alone while painting
+
+static uint8_t *heapEnd()
+{
+    return __brkval ? __brkval : &__heap_start;
+}
+
+void hal::paintStack()
+{
+    uint8_t here;
+    for (uint8_t *p = heapEnd(); p < &here - STACK_PAINT_MARGIN; p++)
+    {
+        *p = STACK_PAINT;
+    }
+}
+
+uint16_t hal::stackHeadroom()
+{
+    uint8_t here;
+    uint8_t *p = heapEnd();
+    while (p < &here && *p == STACK_PAINT)
+    {
+        p++;
+    }
+    return p - heapEnd();
+}
+
+void hal::SpiDevice::beginDevice(uint8_t csPin, uint32_t clock)
+{
+    settings = SPISettings(clock, MSBFIRST, SPI_MODE0);
+    csPort = portOutputRegister(digitalPinToPort(csPin));
+    csMask = digitalPinToBitMask(csPin);
+    pinMode(csPin, OUTPUT);
+    *csPort |= csMask;
+}
+
+uint8_t hal::SpiDevice::select()
+{
+    uint8_t state = SREG;
+    noInterrupts();
+    SPI.beginTransaction(settings);
+    *csPort &= ~csMask;
+    return state;
+}
+
+void hal::SpiDevice::deselect(uint8_t state)
+{
+    *csPort |= csMask;
+    SPI.endTransaction();
+    SREG = state;
+}
+
+void hal::Adc::begin()
+{
+    beginDevice(csPin, ADC_SPI_CLOCK);
+}
+
+uint16_t hal::Adc::readChannel(uint8_t channel)
+{
+    // Start bit, then single ended, channel and MSB first. The 12 bit result
+    // comes back in the low nibble of the second byte and all of the third.
+    uint8_t state = select();
+    SPI.transfer(0x01);
+    uint8_t high = SPI.transfer(0xa0 | (channel << 6)) & 0x0f;
+    uint8_t low = SPI.transfer(0);
+    deselect(state);
+    return ((uint16_t)high << 8) | low;
+}
+
+void hal::Dac::begin(uint8_t csPin, uint8_t ldacPin)
+{
+    beginDevice(csPin, DAC_SPI_CLOCK);
+    if (ldacPin != HAL_NO_PIN)
+    {
+        ldacPort = portOutputRegister(digitalPinToPort(ldacPin));
+        ldacMask = digitalPinToBitMask(ldacPin);
+        pinMode(ldacPin, OUTPUT);
+        *ldacPort |= ldacMask;
+    }
+}
+
+void hal::Dac::load(uint8_t channel, uint16_t value)
+{
+    // Channel select, unbuffered reference, 1x gain, output active
+    uint16_t word = ((uint16_t)(channel & 1) << 15) | 0x3000 | (value > 4095 ? 4095 : value);
+    uint8_t state = select();
+    SPI.transfer16(word);
+    deselect(state);
+}
+
+void hal::Dac::latch()
+{
+    if (ldacPort)
+    {
+        // LDAC low for at least 100 ns. Two cycles at 16 MHz is 125 ns.
+        uint8_t state = SREG;
+        noInterrupts();
+        *ldacPort &= ~ldacMask;
+        __asm__ __volatile__("nop\n\tnop\n\t");
+        *ldacPort |= ldacMask;
+        SREG = state;
+    }
+}
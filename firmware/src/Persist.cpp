@@ -0,0 +1,258 @@
+#include "Persist.hpp"
+#include "Crc.hpp"
+
+bool Persist::readRecord(uint8_t slot, uint8_t *r)
+{
+    uint8_t crc = 0;
+    for (uint8_t i = 0; i < PERSIST_RECORD_SIZE; i++)
+    {
+        r[i] = hal::eepromRead(slot * PERSIST_RECORD_SIZE + i);
+        if (i < PERSIST_RECORD_SIZE - 1)
+        {
+            crc = crc8Update(crc, r[i]);
+        }
+    }
+    return r[0] == PERSIST_VERSION && crc == r[PERSIST_RECORD_SIZE - 1];
+}
+
+bool Persist::restore(PersistState &state)
+{
+    // The newest record is the valid one that isn't followed by its successor.
+    // Only the record after it can be torn, so there is only ever one.
+    uint8_t r[PERSIST_RECORD_SIZE];
+    uint8_t next[PERSIST_RECORD_SIZE];
+    bool valid = readRecord(0, r);
+    bool firstValid = valid;
+    uint8_t firstSeq = r[1];
+    for (uint8_t i = 0; i < PERSIST_LOG_SLOTS; i++)
+    {
+        bool nextValid;
+        uint8_t nextSeq;
+        if (i < PERSIST_LOG_SLOTS - 1)
+        {
+            nextValid = readRecord(i + 1, next);
+            nextSeq = next[1];
+        }
+        else
+        {
+            nextValid = firstValid;
+            nextSeq = firstSeq;
+        }
+        if (valid && !(nextValid && nextSeq == (uint8_t)(r[1] + 1)))
+        {
+            for (uint8_t c = 0; c < NUM_CHANNELS; c++)
+            {
+                state.vSet[c] = r[2 + 4 * c] | (r[3 + 4 * c] << 8);
+                state.iSet[c] = r[4 + 4 * c] | (r[5 + 4 * c] << 8);
+            }
+            state.flags = r[PERSIST_RECORD_SIZE - 2];
+            slot = i < PERSIST_LOG_SLOTS - 1 ? i + 1 : 0;
+            seq = r[1] + 1;
+            saved = state;
+            pending = state;
+            return true;
+        }
+        valid = nextValid;
+        memcpy(r, next, sizeof(r));
+    }
+    return false;
+}
+
+bool Persist::loadBlock(const PersistRegion *regions, uint8_t n)
+{
+    uint16_t size = 0;
+    for (uint8_t i = 0; i < n; i++)
+    {
+        size += regions[i].size;
+    }
+    uint16_t storedSize = hal::eepromRead(PERSIST_BLOCK_ADDR + 1) | (hal::eepromRead(PERSIST_BLOCK_ADDR + 2) << 8);
+    uint16_t storedCrc = hal::eepromRead(PERSIST_BLOCK_ADDR + 3) | (hal::eepromRead(PERSIST_BLOCK_ADDR + 4) << 8);
+    if (hal::eepromRead(PERSIST_BLOCK_ADDR) != PERSIST_VERSION || storedSize != size || size > PERSIST_BLOCK_MAX)
+    {
+        return false;
+    }
+
+    // Check the whole block before touching the regions
+    uint16_t crc = 0xffff;
+    uint16_t addr = PERSIST_BLOCK_ADDR + PERSIST_BLOCK_HEADER;
+    for (uint16_t i = 0; i < size; i++)
+    {
+        crc = crc16Update(crc, hal::eepromRead(addr + i));
+    }
+    if (crc != storedCrc)
+    {
+        return false;
+    }
+    for (uint8_t i = 0; i < n; i++)
+    {
+        uint8_t *p = (uint8_t *)regions[i].data;
+        for (uint16_t j = 0; j < regions[i].size; j++)
+        {
+            p[j] = hal::eepromRead(addr++);
+        }
+    }
+    return true;
+}
+
+void Persist::saveBlock(const PersistRegion *regions, uint8_t n)
+{
+    uint16_t size = 0;
+    uint16_t crc = 0xffff;
+    for (uint8_t i = 0; i < n; i++)
+    {
+        const uint8_t *p = (const uint8_t *)regions[i].data;
+        for (uint16_t j = 0; j < regions[i].size; j++)
+        {
+            crc = crc16Update(crc, p[j]);
+        }
+        size += regions[i].size;
+    }
+    if (size > PERSIST_BLOCK_MAX)
+    {
+        return;
+    }
+    this->regions = regions;
+    regionCount = n;
+    region = 0;
+    regionPos = 0;
+    header[0] = PERSIST_VERSION;
+    header[1] = size;
+    header[2] = size >> 8;
+    header[3] = crc;
+    header[4] = crc >> 8;
+    blockPos = 0;
+    blockEnd = size + PERSIST_BLOCK_HEADER + 1;
+}
+
+void Persist::update(const PersistState &state)
+{
+    if (state == pending)
+    {
+        return;
+    }
+    pending = state;
+    changedAt = hal::millis();
+    dirty = !(state == saved);
+}
+
+void Persist::poll()
+{
+    if (!hal::eepromReady())
+    {
+        return;
+    }
+    if (blockPos < blockEnd)
+    {
+        writeBlock();
+        return;
+    }
+    if (recordPos <= PERSIST_RECORD_SIZE)
+    {
+        writeRecord();
+        return;
+    }
+    if (!dirty || hal::millis() - changedAt < PERSIST_SETTLE_TIME)
+    {
+        return;
+    }
+
+    // Settled. Start a new record in the next slot.
+    dirty = false;
+    saved = pending;
+    record[0] = PERSIST_VERSION;
+    record[1] = seq++;
+    for (uint8_t c = 0; c < NUM_CHANNELS; c++)
+    {
+        record[2 + 4 * c] = saved.vSet[c];
+        record[3 + 4 * c] = saved.vSet[c] >> 8;
+        record[4 + 4 * c] = saved.iSet[c];
+        record[5 + 4 * c] = saved.iSet[c] >> 8;
+    }
+    record[PERSIST_RECORD_SIZE - 2] = saved.flags;
+    uint8_t crc = 0;
+    for (uint8_t i = 0; i < PERSIST_RECORD_SIZE - 1; i++)
+    {
+        crc = crc8Update(crc, record[i]);
+    }
+    record[PERSIST_RECORD_SIZE - 1] = crc;
+    recordPos = 0;
+    writeRecord();
+}
+
+// Starts a write if the byte differs, which saves both time and wear
+bool Persist::write(uint16_t addr, uint8_t value)
+{
+    if (hal::eepromRead(addr) == value)
+    {
+        return false;
+    }
+    hal::eepromWrite(addr, value);
+    return true;
+}
+
+void Persist::writeRecord()
+{
+    uint16_t base = slot * PERSIST_RECORD_SIZE;
+    while (recordPos <= PERSIST_RECORD_SIZE)
+    {
+        uint8_t step = recordPos++;
+        bool started;
+        if (step == 0)
+        {
+            started = write(base, 0);
+        }
+        else if (step < PERSIST_RECORD_SIZE)
+        {
+            started = write(base + step, record[step]);
+        }
+        else
+        {
+            started = write(base, record[0]);
+        }
+        if (recordPos > PERSIST_RECORD_SIZE)
+        {
+            slot = slot < PERSIST_LOG_SLOTS - 1 ? slot + 1 : 0;
+        }
+        if (started)
+        {
+            return;
+        }
+    }
+}
+
+void Persist::writeBlock()
+{
+    uint16_t size = blockEnd - PERSIST_BLOCK_HEADER - 1;
+    while (blockPos < blockEnd)
+    {
+        uint16_t step = blockPos++;
+        bool started;
+        if (step == 0)
+        {
+            started = write(PERSIST_BLOCK_ADDR, 0);
+        }
+        else if (step <= size)
+        {
+            while (region < regionCount - 1 && regionPos == regions[region].size)
+            {
+                region++;
+                regionPos = 0;
+            }
+            uint8_t value = ((const uint8_t *)regions[region].data)[regionPos++];
+            started = write(PERSIST_BLOCK_ADDR + PERSIST_BLOCK_HEADER + step - 1, value);
+        }
+        else if (step < blockEnd - 1)
+        {
+            uint8_t i = step - size;
+            started = write(PERSIST_BLOCK_ADDR + i, header[i]);
+        }
+        else
+        {
+            started = write(PERSIST_BLOCK_ADDR, header[0]);
+        }
+        if (started)
+        {
+            return;
+        }
+    }
+}
@@ -0,0 +1,138 @@
+/*
+Copyright 2023, Pontus Rydin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in
+the Software without restriction, including without limitation the rights to use,
+copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef __PERSIST_HPP
+#define __PERSIST_HPP
+#include "Hal.hpp"
+
+// EEPROM layout:
+//
+//   0                    State log: PERSIST_LOG_SLOTS records of PERSIST_RECORD_SIZE bytes
+//   PERSIST_BLOCK_ADDR   Block (calibration): version, u16 size, u16 CRC-16, data
+//
+// State records are written to the slot after the newest one, so wear is
+// spread evenly across the log. A record is
+//
+//   version, seq, (u16 vSet, u16 iSet) for each channel, flags, CRC-8 over everything before it
+//
+// The version byte is zeroed first and written last, so a record torn by a
+// power failure is never valid and restore() falls back to the one before it.
+// The block is written the same way and simply isn't loaded if torn.
+//
+// With more than one channel the records grow and the log has fewer slots,
+// to leave room in the block for the calibration of every channel.
+#define PERSIST_VERSION (0x51 + NUM_CHANNELS - 1) // Change when the layout of anything stored changes
+#define PERSIST_RECORD_SIZE (4 + 4 * NUM_CHANNELS)
+#define PERSIST_LOG_SLOTS (NUM_CHANNELS > 1 ? 40 : 80)
+#define PERSIST_LOG_SIZE (PERSIST_LOG_SLOTS * PERSIST_RECORD_SIZE)
+#define PERSIST_BLOCK_ADDR PERSIST_LOG_SIZE
+#define PERSIST_BLOCK_HEADER 5
+#define PERSIST_BLOCK_MAX (HAL_EEPROM_SIZE - PERSIST_BLOCK_ADDR - PERSIST_BLOCK_HEADER)
+#define PERSIST_SETTLE_TIME 2000 // State must be unchanged this long (ms) before it's written
+
+// Bits in PersistState::flags
+#define PERSIST_OUTPUT_ON 1     // Output of the first channel on; the next bits are the channels after it
+#define PERSIST_TRACK_SHIFT 6   // Tracking mode (see main.cpp) in the top two bits
+
+struct PersistState
+{
+    uint16_t vSet[NUM_CHANNELS];
+    uint16_t iSet[NUM_CHANNELS];
+    uint8_t flags;
+
+    bool operator==(const PersistState &s) const
+    {
+        for (uint8_t i = 0; i < NUM_CHANNELS; i++)
+        {
+            if (vSet[i] != s.vSet[i] || iSet[i] != s.iSet[i])
+            {
+                return false;
+            }
+        }
+        return flags == s.flags;
+    }
+};
+
+// A piece of memory stored in the block
+struct PersistRegion
+{
+    void *data;
+    uint16_t size;
+};
+
+// Keeps settings in EEPROM without ever waiting for it. update() just notes
+// the latest state; poll() writes at most one byte per call, and only when
+// the EEPROM is ready for it, so nothing blocks on the 3.3 ms write time.
+class Persist
+{
+public:
+    // Reads the newest valid state record. Returns false if there is none.
+    bool restore(PersistState &state);
+
+    // Fills the regions from the block. Leaves them alone and returns false
+    // if the block is missing, torn or doesn't match the regions in size.
+    bool loadBlock(const PersistRegion *regions, uint8_t n);
+
+    // Queues the regions to be written to the block. They must not change
+    // until isBusy() returns false.
+    void saveBlock(const PersistRegion *regions, uint8_t n);
+
+    // Notes the current state. It's written once it has been left alone for
+    // PERSIST_SETTLE_TIME, so a knob spin results in a single record.
+    void update(const PersistState &state);
+
+    // Call often. Moves pending writes along.
+    void poll();
+
+    bool isBusy()
+    {
+        return recordPos <= PERSIST_RECORD_SIZE || blockPos < blockEnd;
+    }
+
+private:
+    PersistState saved = PersistState();   // What's in (or going into) the newest record
+    PersistState pending = PersistState(); // The latest state from update()
+    uint32_t changedAt = 0;
+    bool dirty = false;
+
+    uint8_t slot = 0; // Where the next record goes
+    uint8_t seq = 0;
+    uint8_t record[PERSIST_RECORD_SIZE];
+    uint8_t recordPos = PERSIST_RECORD_SIZE + 1; // Write steps done: zeroing the version, the rest, the version
+
+    const PersistRegion *regions = nullptr;
+    uint8_t regionCount = 0;
+    uint8_t region = 0;
+    uint16_t regionPos = 0;
+    uint8_t header[PERSIST_BLOCK_HEADER];
+    uint16_t blockPos = 0; // Write steps done: zeroing the version, data, header, the version
+    uint16_t blockEnd = 0;
+
+    bool readRecord(uint8_t slot, uint8_t *r);
+
+    bool write(uint16_t addr, uint8_t value);
+
+    void writeRecord();
+
+    void writeBlock();
+};
+#endif
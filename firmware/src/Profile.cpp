@@ -0,0 +1,50 @@
+#include "Profile.hpp"
+
+#ifdef PROFILE
+Profiler profiler;
+
+void Profiler::add(ProfileSection section, uint32_t us)
+{
+    ProfileStats &s = stats[section];
+    uint16_t t = us > 0xffff ? 0xffff : us;
+    uint8_t bucket = 0;
+    while (t >> bucket && bucket < PROFILE_BUCKETS - 1)
+    {
+        bucket++;
+    }
+    s.min = min(s.min, t);
+    s.max = max(s.max, t);
+    s.sum += t;
+    s.count++;
+    if (s.histogram[bucket] != 0xffff)
+    {
+        s.histogram[bucket]++;
+    }
+}
+
+// Each section is only added to from one context, and get() and reset() only
+// run in loop(), so they only need protecting against the sampler interrupt.
+void Profiler::get(ProfileSection section, ProfileStats &copy)
+{
+    uint8_t state = hal::disableInterrupts();
+    copy = stats[section];
+    hal::restoreInterrupts(state);
+}
+
+void Profiler::reset()
+{
+    uint8_t state = hal::disableInterrupts();
+    memset(stats, 0, sizeof(stats));
+    for (uint8_t i = 0; i < PROFILE_SECTIONS; i++)
+    {
+        stats[i].min = 0xffff;
+    }
+    hal::restoreInterrupts(state);
+}
+
+void Profiler::getName(ProfileSection section, char name[PROFILE_NAME_MAX])
+{
+    static const char names[PROFILE_SECTIONS][PROFILE_NAME_MAX] PROGMEM = {"loop", "isr", "disp", "rpm", "knob", "trip"};
+    strcpy_P(name, names[section]);
+}
+#endif
@@ -0,0 +1,112 @@
+/*
+Copyright 2023, Pontus Rydin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in
+the Software without restriction, including without limitation the rights to use,
+copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef __PROFILE_HPP
+#define __PROFILE_HPP
+#include "Hal.hpp"
+
+// Timing instrumentation for the hot paths. Only built with -DPROFILE; without
+// it the macros below expand to nothing and none of this takes any space.
+//
+// Times come from hal::micros(), which has a resolution of 4 us on the 32u4.
+// Each section keeps min/max/mean and a histogram with log2 sized buckets:
+// bucket 0 counts 0 us, bucket k counts [2^(k-1), 2^k) us and the last bucket
+// everything from 2^(PROFILE_BUCKETS-2) us up.
+
+#ifdef PROFILE
+#define PROFILE_BUCKETS 13
+#define PROFILE_NAME_MAX 5 // Longest section name, with the terminator
+
+enum ProfileSection
+{
+    profileLoop,      // One pass through loop()
+    profileSampler,   // The sampling timer interrupt
+    profileDisplay,   // Display::refresh()
+    profileFanSpeed,  // TempControl::getCachedSpeed()
+    profileKnobToDac, // From the last encoder poll before a turn to the DAC write
+    profileTrip,      // From the first sample over an OVP/OCP limit to the DAC being zeroed
+    PROFILE_SECTIONS
+};
+
+struct ProfileStats
+{
+    uint16_t min;
+    uint16_t max;
+    uint32_t sum;
+    uint32_t count;
+    uint16_t histogram[PROFILE_BUCKETS]; // Saturates at 0xffff
+
+    uint16_t getMean() const
+    {
+        return count ? sum / count : 0;
+    }
+};
+
+class Profiler
+{
+public:
+    Profiler()
+    {
+        reset();
+    }
+
+    void add(ProfileSection section, uint32_t us);
+
+    // Copies the stats of a section. Safe against updates from interrupts.
+    void get(ProfileSection section, ProfileStats &stats);
+
+    void reset();
+
+    // Copies the short name of a section
+    static void getName(ProfileSection section, char name[PROFILE_NAME_MAX]);
+
+private:
+    ProfileStats stats[PROFILE_SECTIONS];
+};
+
+extern Profiler profiler;
+
+// Times the rest of the enclosing scope
+class ProfileScope
+{
+public:
+    ProfileScope(ProfileSection section) : section(section), start(hal::micros())
+    {
+    }
+
+    ~ProfileScope()
+    {
+        profiler.add(section, hal::micros() - start);
+    }
+
+private:
+    ProfileSection section;
+    uint32_t start;
+};
+
+#define PROFILE_SCOPE(section) ProfileScope profileScope(section)
+#define PROFILE_ADD(section, us) profiler.add(section, us)
+#else
+#define PROFILE_SCOPE(section)
+#define PROFILE_ADD(section, us)
+#endif
+#endif
@@ -0,0 +1,95 @@
+/*
+Copyright 2023, Pontus Rydin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in
+the Software without restriction, including without limitation the rights to use,
+copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef __PROTECTION_HPP
+#define __PROTECTION_HPP
+#include "Hal.hpp"
+
+#define PROTECT_OFF 0xffff // Limit code that never trips
+
+// Faults, as bits
+#define PROTECT_OVP 1
+#define PROTECT_OCP 2
+
+// Over-voltage and over-current trip, checked against the raw ADC codes in
+// the sampling interrupt so it doesn't wait for the filters or for loop().
+// The first sample at or over a limit trips it.
+// A trip latches until clear() is called. The caller zeroes the DAC from the
+// interrupt as soon as check() returns true, and anything in loop() that
+// writes the DAC must do so with interrupts disabled and getFault() clear,
+// so a trip can't be overwritten by a write it interrupted.
+class OutputProtection
+{
+public:
+    // Sets the limits, as the raw codes at which a trip starts. Call from loop().
+    void setLimits(uint16_t voltCode, uint16_t ampCode)
+    {
+        uint8_t state = hal::disableInterrupts();
+        voltLimit = voltCode;
+        ampLimit = ampCode;
+        hal::restoreInterrupts(state);
+    }
+
+    // Call from the sampling interrupt with the latest codes. Returns true
+    // when a limit has just tripped.
+    bool check(uint16_t voltCode, uint16_t ampCode)
+    {
+        if (fault)
+        {
+            return false;
+        }
+        uint8_t over = (voltCode >= voltLimit ? PROTECT_OVP : 0) | (ampCode >= ampLimit ? PROTECT_OCP : 0);
+        if (!over)
+        {
+            return false;
+        }
+        overSince = hal::micros();
+        fault = over;
+        return true;
+    }
+
+    // PROTECT_OVP and/or PROTECT_OCP while tripped, otherwise 0
+    uint8_t getFault()
+    {
+        return fault;
+    }
+
+    void clear()
+    {
+        uint8_t state = hal::disableInterrupts();
+        fault = 0;
+        hal::restoreInterrupts(state);
+    }
+
+    // When the sample over the limit was checked, for timing the trip
+    uint32_t getOverSince()
+    {
+        return overSince;
+    }
+
+private:
+    uint16_t voltLimit = PROTECT_OFF;
+    uint16_t ampLimit = PROTECT_OFF;
+    volatile uint8_t fault = 0;
+    uint32_t overSince = 0;
+};
+#endif
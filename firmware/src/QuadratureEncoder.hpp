@@ -0,0 +1,115 @@
+/*
+Copyright 2023, Pontus Rydin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in
+the Software without restriction, including without limitation the rights to use,
+copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef __QUADRATURE_ENCODER_HPP
+#define __QUADRATURE_ENCODER_HPP
+#include "Hal.hpp"
+
+// Decodes a quadrature rotary encoder from a periodic interrupt. Detents are
+// counted in an 8 bit counter only the interrupt writes, and the main loop
+// takes them as the difference from the count it last saw, so no locking is
+// needed on either side. The pins are read by QuadraturePins below.
+//
+// Uses the same transition table and pin order as mathertel's RotaryEncoder
+// in TWO03 latch mode (a detent at both state 0 and state 3), so the direction
+// is the same as before. Invalid transitions, e.g. from contact bounce, are
+// ignored, and bounce between two states cancels out.
+class QuadratureEncoder
+{
+public:
+    // Detents turned since the last call. Call from loop() only.
+    int8_t takeDetents()
+    {
+        uint8_t c = count;
+        int8_t delta = c - taken;
+        taken = c;
+        return delta;
+    }
+
+    // True if the push switch was held down at the last service()
+    bool isPressed()
+    {
+        return pressed;
+    }
+
+protected:
+    uint8_t state;
+
+    // Takes the pin state (pin1 | pin2 << 1) and switch seen by service()
+    void update(uint8_t now, bool down)
+    {
+        pressed = down;
+        if (now == state)
+        {
+            return;
+        }
+        steps += direction(state, now);
+        state = now;
+        if (now == 0 || now == 3)
+        {
+            // Latched. A full detent is two steps; anything less was bounce.
+            count += steps / 2;
+            steps = 0;
+        }
+    }
+
+private:
+    int8_t steps = 0;            // Steps since the last latch state
+    volatile uint8_t count = 0;  // Detents, written by the interrupt only
+    uint8_t taken = 0;           // Value of count at the last takeDetents()
+    volatile bool pressed = false;
+
+    static int8_t direction(uint8_t from, uint8_t to)
+    {
+        static const int8_t table[16] = {0, -1, 1, 0, 1, 0, 0, -1, -1, 0, 0, 1, 0, 1, -1, 0};
+        return table[(from << 2) | to];
+    }
+};
+
+// An encoder and its push switch on pins fixed at compile time, so the
+// interrupt reads all three with single port instructions.
+template <uint8_t pin1, uint8_t pin2, uint8_t switchPin>
+class QuadraturePins : public QuadratureEncoder
+{
+public:
+    QuadraturePins()
+    {
+        hal::Pin<pin1>::setMode(INPUT_PULLUP);
+        hal::Pin<pin2>::setMode(INPUT_PULLUP);
+        hal::Pin<switchPin>::setMode(INPUT_PULLUP);
+        state = readState();
+    }
+
+    // Call from the interrupt. Needs to run at least once per state change;
+    // at 2 kHz that's up to 1000 detents per second.
+    void service()
+    {
+        update(readState(), hal::Pin<switchPin>::read() == LOW);
+    }
+
+private:
+    static uint8_t readState()
+    {
+        return hal::Pin<pin1>::read() | (hal::Pin<pin2>::read() << 1);
+    }
+};
+#endif
@@ -0,0 +1,233 @@
+/*
+Copyright 2023, Pontus Rydin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in
+the Software without restriction, including without limitation the rights to use,
+copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef __SAMPLER_HPP
+#define __SAMPLER_HPP
+#include "Hal.hpp"
+
+#define SAMPLE_CHANNELS (2 * NUM_CHANNELS + 1) // MCP3202 channel 0 and 1 of each output, plus the thermistor
+#define SAMPLE_THERM (2 * NUM_CHANNELS)        // Channel number used for the thermistor
+#define SAMPLE_QUEUE_SIZE 64     // Must be a power of two
+#define SAMPLE_CHANNEL_SHIFT 12  // Queue entries carry the channel in the top bits
+#define SAMPLE_CODE_MASK 0x0fff
+
+// Sample channel of input (0 or 1) of an output's MCP3202, and back
+#define SAMPLE_INPUT(output, input) (2 * (output) + (input))
+#define SAMPLE_OUTPUT(channel) ((channel) >> 1)
+
+static_assert(SAMPLE_CHANNELS <= (1 << (16 - SAMPLE_CHANNEL_SHIFT)), "Too many sample channels for the queue entries");
+
+// Lock free single producer, single consumer queue of raw samples. push() is
+// called from the sampling interrupt and pop() from loop(). Each side only
+// writes its own index and the indexes are single bytes, so neither side ever
+// sees a half updated queue.
+class SampleQueue
+{
+public:
+    // Returns false and counts an overrun if the queue is full
+    bool push(uint16_t entry)
+    {
+        uint8_t h = head;
+        if ((uint8_t)(h - tail) == SAMPLE_QUEUE_SIZE)
+        {
+            overruns++;
+            return false;
+        }
+        entries[h & (SAMPLE_QUEUE_SIZE - 1)] = entry;
+        head = h + 1;
+        return true;
+    }
+
+    bool pop(uint16_t &entry)
+    {
+        uint8_t t = tail;
+        if (t == head)
+        {
+            return false;
+        }
+        entry = entries[t & (SAMPLE_QUEUE_SIZE - 1)];
+        tail = t + 1;
+        return true;
+    }
+
+    uint8_t getOverruns()
+    {
+        return overruns;
+    }
+
+private:
+    volatile uint16_t entries[SAMPLE_QUEUE_SIZE];
+    volatile uint8_t head = 0;
+    volatile uint8_t tail = 0;
+    volatile uint8_t overruns = 0;
+};
+
+// Sums 4^bits samples into one reading with bits more bits of resolution.
+// Oversampling only adds resolution if there is at least an LSB of noise on
+// the input, which the MCP3202 has plenty of.
+class Decimator
+{
+public:
+    Decimator(uint8_t bits) : bits(bits), samples(1 << (2 * bits))
+    {
+    }
+
+    // Returns true when a new reading is available
+    bool update(uint16_t code)
+    {
+        sum += code;
+        if (++n < samples)
+        {
+            return false;
+        }
+        value = sum >> bits;
+        sum = 0;
+        n = 0;
+        return true;
+    }
+
+    uint16_t get()
+    {
+        return value;
+    }
+
+private:
+    uint8_t bits;
+    uint16_t samples;
+    uint16_t n = 0;
+    uint32_t sum = 0;
+    uint16_t value = 0;
+};
+
+// Samples the ADC channels from a timer interrupt running at a fixed base
+// rate. Each channel is sampled every divider ticks, so channels can run at
+// different rates. Raw codes are queued for loop() to consume.
+//
+// With more than one output, the outputs take turns: each tick samples both
+// channels of one output's ADC, so the interrupt takes the same time however
+// many outputs there are, and each output is sampled at the base rate divided
+// by NUM_CHANNELS.
+class Sampler
+{
+public:
+    // adcs has the ADC of each output
+    Sampler(hal::Adc *const *adcs, uint8_t thermPin) : adcs(adcs), thermPin(thermPin)
+    {
+        for (uint8_t i = 0; i < SAMPLE_CHANNELS; i++)
+        {
+            dividers[i] = 1;
+            countdown[i] = 1;
+        }
+    }
+
+    // Sample channel every divider ticks of the base rate. Call before the
+    // timer is started.
+    void setDivider(uint8_t channel, uint16_t divider)
+    {
+        dividers[channel] = divider;
+    }
+
+    // Called from the timer interrupt
+    void onTimer()
+    {
+        for (uint8_t i = 0; i < SAMPLE_CHANNELS; i++)
+        {
+            if (i != SAMPLE_THERM && SAMPLE_OUTPUT(i) != turn)
+            {
+                continue;
+            }
+            if (--countdown[i])
+            {
+                continue;
+            }
+            countdown[i] = dividers[i];
+            uint16_t code;
+            if (i == SAMPLE_THERM)
+            {
+                // Collect the conversion started last time and start the next
+                // one, so the interrupt never waits on the internal ADC. The
+                // reading is a divider period old, which the thermistor won't notice.
+                bool ready = converting && hal::analogReady();
+                if (ready)
+                {
+                    code = hal::readAnalogResult();
+                }
+                converting = true;
+                hal::startAnalog(thermPin);
+                if (!ready)
+                {
+                    continue;
+                }
+            }
+            else
+            {
+                code = adcs[SAMPLE_OUTPUT(i)]->readChannel(i & 1);
+            }
+            last[i] = code;
+            queue.push(((uint16_t)i << SAMPLE_CHANNEL_SHIFT) | code);
+        }
+        sampled = turn;
+        turn = turn < NUM_CHANNELS - 1 ? turn + 1 : 0;
+    }
+
+    // Fetches the oldest queued sample, if any
+    bool next(uint8_t &channel, uint16_t &code)
+    {
+        uint16_t entry;
+        if (!queue.pop(entry))
+        {
+            return false;
+        }
+        channel = entry >> SAMPLE_CHANNEL_SHIFT;
+        code = entry & SAMPLE_CODE_MASK;
+        return true;
+    }
+
+    uint8_t getOverruns()
+    {
+        return queue.getOverruns();
+    }
+
+    // The latest code of a channel, for checks made in the interrupt itself
+    uint16_t getLast(uint8_t channel)
+    {
+        return last[channel];
+    }
+
+    // The output sampled by the last onTimer()
+    uint8_t getSampled()
+    {
+        return sampled;
+    }
+
+private:
+    hal::Adc *const *adcs;
+    uint8_t thermPin;
+    uint8_t turn = 0;
+    uint8_t sampled = 0;
+    uint16_t dividers[SAMPLE_CHANNELS];
+    uint16_t countdown[SAMPLE_CHANNELS];
+    uint16_t last[SAMPLE_CHANNELS] = {};
+    bool converting = false; // A thermistor conversion has been started
+    SampleQueue queue;
+};
+#endif
@@ -0,0 +1,161 @@
+/*
+Copyright 2023, Pontus Rydin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in
+the Software without restriction, including without limitation the rights to use,
+copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef __SCHEDULER_HPP
+#define __SCHEDULER_HPP
+#include "Hal.hpp"
+
+// A task run by the Scheduler, along with its timing record (with -DPROFILE,
+// read with DIAGnostic:TASK?)
+struct Task
+{
+    const hal::FlashString *name;
+    void (*run)();
+    uint32_t period;  // Microseconds between starts
+    uint8_t priority; // Lower runs first
+    uint32_t due;     // When the next run should start
+
+#ifdef PROFILE
+    uint32_t runs;
+    uint16_t lastUs;  // Runtime of the last run
+    uint16_t maxUs;   // Longest runtime
+    uint16_t maxLate; // Longest delay between due and start (microseconds)
+    uint16_t skipped; // Periods dropped because the task was more than a period late
+#endif
+};
+
+// Static, cooperative fixed-period scheduler. Every call to run() starts at
+// most one task: the highest priority one that is due. A task that runs long
+// therefore delays a higher priority task by at most its own runtime, and
+// never makes it miss more than that. Tasks that fall more than a full
+// period behind drop the missed periods rather than running back to back.
+template <uint8_t N>
+class Scheduler
+{
+public:
+    // Adds a task, returning false if the table is full. The first run is due right away.
+    bool add(const hal::FlashString *name, void (*run)(), uint32_t periodUs, uint8_t priority)
+    {
+        if (count == N)
+        {
+            return false;
+        }
+        // Keep the table sorted by priority so run() can stop at the first due task
+        uint8_t i = count++;
+        for (; i > 0 && tasks[i - 1].priority > priority; i--)
+        {
+            tasks[i] = tasks[i - 1];
+        }
+        Task &t = tasks[i];
+        memset(&t, 0, sizeof(t));
+        t.name = name;
+        t.run = run;
+        t.period = periodUs;
+        t.priority = priority;
+        t.due = hal::micros();
+        return true;
+    }
+
+    // Runs the highest priority task that is due. Returns false if none was.
+    bool run()
+    {
+        uint32_t now = hal::micros();
+        for (uint8_t i = 0; i < count; i++)
+        {
+            Task &t = tasks[i];
+            int32_t late = now - t.due;
+            if (late < 0)
+            {
+                continue;
+            }
+            t.run();
+            uint32_t end = hal::micros();
+
+#ifdef PROFILE
+            t.runs++;
+            t.lastUs = clip(end - now);
+            t.maxUs = max(t.maxUs, t.lastUs);
+            t.maxLate = max(t.maxLate, clip(late));
+#endif
+            t.due += t.period;
+            if ((int32_t)(end - t.due) >= 0)
+            {
+#ifdef PROFILE
+                t.skipped += (end - t.due) / t.period + 1;
+#endif
+                t.due = end + t.period - (end - t.due) % t.period;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    // Microseconds until the next task is due, 0 if one already is
+    uint32_t untilDue()
+    {
+        uint32_t now = hal::micros();
+        uint32_t soonest = 0xffffffff;
+        for (uint8_t i = 0; i < count; i++)
+        {
+            int32_t wait = tasks[i].due - now;
+            soonest = min(soonest, (uint32_t)max(wait, (int32_t)0));
+        }
+        return soonest;
+    }
+
+#ifdef PROFILE
+    uint8_t getCount()
+    {
+        return count;
+    }
+
+    // Tasks in priority order
+    Task &getTask(uint8_t i)
+    {
+        return tasks[i];
+    }
+
+    // Clears the timing records
+    void resetStats()
+    {
+        for (uint8_t i = 0; i < count; i++)
+        {
+            tasks[i].runs = 0;
+            tasks[i].maxUs = 0;
+            tasks[i].maxLate = 0;
+            tasks[i].skipped = 0;
+        }
+    }
+#endif
+
+private:
+    Task tasks[N];
+    uint8_t count = 0;
+
+#ifdef PROFILE
+    static uint16_t clip(uint32_t us)
+    {
+        return us > 0xffff ? 0xffff : us;
+    }
+#endif
+};
+#endif
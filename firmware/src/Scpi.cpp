@@ -0,0 +1,889 @@
+#include <ctype.h>
+#include "Scpi.hpp"
+
+#define SCPI_IDN "prydin,Lab Supply,0,1.0"
+
+// Matches a mnemonic in either its short form (the first shortLen characters)
+// or its long form, case insensitively. Advances p past it on success.
+static bool match(const char *&p, const hal::FlashString *longForm, uint8_t shortLen)
+{
+    uint8_t n = 0;
+    while (isalpha(p[n]) && hal::readFlashChar(longForm, n) && toupper(p[n]) == hal::readFlashChar(longForm, n))
+    {
+        n++;
+    }
+    if (isalpha(p[n]) || (n != shortLen && hal::readFlashChar(longForm, n)))
+    {
+        return false;
+    }
+    p += n;
+    return true;
+}
+
+static const char *skipSpace(const char *p)
+{
+    while (*p == ' ' || *p == '\t')
+    {
+        p++;
+    }
+    return p;
+}
+
+// Parses an unsigned decimal number into milli-units, advancing p past it
+static bool parseDecimal(const char *&p, int32_t &value)
+{
+    p = skipSpace(p);
+    if (*p == '+')
+    {
+        p++;
+    }
+    if (!isdigit(*p) && *p != '.')
+    {
+        return false;
+    }
+    int32_t whole = 0;
+    while (isdigit(*p))
+    {
+        whole = whole * 10 + (*p++ - '0');
+        if (whole > 100000)
+        {
+            return false;
+        }
+    }
+    int32_t frac = 0;
+    int32_t scale = 100;
+    if (*p == '.')
+    {
+        p++;
+        while (isdigit(*p))
+        {
+            frac += (*p++ - '0') * scale;
+            scale /= 10;
+        }
+    }
+    value = whole * 1000 + frac;
+    return true;
+}
+
+// Parses a decimal number with an optional unit (V, A, MV, MA) into milli-units.
+static bool parseMilli(const char *p, int32_t &value)
+{
+    if (!parseDecimal(p, value))
+    {
+        return false;
+    }
+    p = skipSpace(p);
+    if (toupper(p[0]) == 'M' && (toupper(p[1]) == 'V' || toupper(p[1]) == 'A'))
+    {
+        value = (value + 500) / 1000;
+        p += 2;
+    }
+    else if (toupper(*p) == 'V' || toupper(*p) == 'A')
+    {
+        p++;
+    }
+    return *skipSpace(p) == 0;
+}
+
+bool Scpi::poll(ScpiRequest &req)
+{
+    flush();
+    for (uint8_t i = 0; i < SCPI_POLL_BYTES && hal::serialAvailable() > 0; i++)
+    {
+        char c = hal::serialRead();
+        if (c != '\n' && c != '\r')
+        {
+            if (lineLen < SCPI_LINE_MAX - 1)
+            {
+                line[lineLen++] = c;
+            }
+            else
+            {
+                overrun = true;
+            }
+            continue;
+        }
+        if (lineLen == 0 && !overrun)
+        {
+            continue;
+        }
+        line[lineLen] = 0;
+        lineLen = 0;
+        if (overrun)
+        {
+            overrun = false;
+            error(SCPI_INPUT_OVERRUN);
+            continue;
+        }
+        if (parse(req))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Scpi::parse(ScpiRequest &req)
+{
+    const char *p = skipSpace(line);
+    if (*p == '*')
+    {
+        p++;
+        if (match(p, F("IDN"), 3) && *p == '?')
+        {
+            reply(F(SCPI_IDN));
+        }
+        else if (match(p, F("TRG"), 3) && !*skipSpace(p))
+        {
+            req.type = ScpiRequest::listTrigger;
+            return true;
+        }
+        else
+        {
+            error(SCPI_UNDEFINED_HEADER);
+        }
+        return false;
+    }
+    if (match(p, F("SYSTEM"), 4))
+    {
+        if (*p++ != ':' || !match(p, F("ERROR"), 3) || *p != '?')
+        {
+            error(SCPI_UNDEFINED_HEADER);
+            return false;
+        }
+        char buf[32];
+        if (errorCount == 0)
+        {
+            reply(F("0,\"No error\""));
+            return false;
+        }
+        int16_t code = errors[0];
+        memmove(errors, errors + 1, --errorCount * sizeof(errors[0]));
+        const hal::FlashString *msg;
+        switch (code)
+        {
+        case SCPI_DATA_TYPE_ERROR:
+            msg = F("Data type error");
+            break;
+        case SCPI_UNDEFINED_HEADER:
+            msg = F("Undefined header");
+            break;
+        case SCPI_TRIGGER_IGNORED:
+            msg = F("Trigger ignored");
+            break;
+        case SCPI_SETTINGS_CONFLICT:
+            msg = F("Settings conflict");
+            break;
+        case SCPI_DATA_OUT_OF_RANGE:
+            msg = F("Data out of range");
+            break;
+        case SCPI_TOO_MUCH_DATA:
+            msg = F("Too much data");
+            break;
+        case SCPI_QUEUE_OVERFLOW:
+            msg = F("Queue overflow");
+            break;
+        case SCPI_INPUT_OVERRUN:
+            msg = F("Input buffer overrun");
+            break;
+        case SCPI_QUERY_INTERRUPTED:
+            msg = F("Query INTERRUPTED");
+            break;
+        default:
+            msg = F("Command error");
+        }
+        uint8_t n = snprintf_P(buf, sizeof(buf), PSTR("%d,\""), code);
+        strlcpy_P(buf + n, (const char *)msg, sizeof(buf) - n - 1);
+        n = strlen(buf);
+        buf[n++] = '"';
+        buf[n] = 0;
+        reply(buf);
+        return false;
+    }
+
+    if (match(p, F("CALIBRATION"), 3))
+    {
+        return parseCalibration(p, req);
+    }
+
+    if (match(p, F("LIST"), 4))
+    {
+        return parseList(p, req);
+    }
+
+    if (match(p, F("METER"), 3))
+    {
+        return parseMeter(p, req);
+    }
+
+    if (match(p, F("INSTRUMENT"), 4))
+    {
+        return parseInstrument(p, req);
+    }
+
+#ifdef PROFILE
+    if (match(p, F("DIAGNOSTIC"), 4))
+    {
+        return parseDiagnostic(p, req);
+    }
+#endif
+
+    bool measure = false;
+    if (match(p, F("MEASURE"), 4))
+    {
+        if (*p++ != ':')
+        {
+            error(SCPI_UNDEFINED_HEADER);
+            return false;
+        }
+        measure = true;
+    }
+    else if (match(p, F("SOURCE"), 4) && *p++ != ':')
+    {
+        error(SCPI_UNDEFINED_HEADER);
+        return false;
+    }
+
+    bool boolArg = false;
+    if (match(p, F("VOLTAGE"), 4))
+    {
+        req.type = measure ? ScpiRequest::measVoltage : ScpiRequest::setVoltage;
+        if (!measure && *p == ':')
+        {
+            p++;
+            if (match(p, F("TRIM"), 4))
+            {
+                req.type = ScpiRequest::setTrim;
+                boolArg = true;
+            }
+            else if (match(p, F("PROTECTION"), 4))
+            {
+                req.type = ScpiRequest::setOvp;
+            }
+            else
+            {
+                error(SCPI_UNDEFINED_HEADER);
+                return false;
+            }
+        }
+    }
+    else if (match(p, F("CURRENT"), 4))
+    {
+        req.type = measure ? ScpiRequest::measCurrent : ScpiRequest::setCurrent;
+        if (!measure && *p == ':')
+        {
+            p++;
+            if (!match(p, F("PROTECTION"), 4))
+            {
+                error(SCPI_UNDEFINED_HEADER);
+                return false;
+            }
+            req.type = ScpiRequest::setOcp;
+        }
+    }
+    else if (measure && match(p, F("TEMPERATURE"), 4))
+    {
+        req.type = ScpiRequest::measTemperature;
+    }
+    else if (measure && match(p, F("FAN"), 3))
+    {
+        req.type = ScpiRequest::measFan;
+    }
+    else if (!measure && match(p, F("OUTPUT"), 4))
+    {
+        req.type = ScpiRequest::setOutput;
+        boolArg = true;
+        if (*p == ':')
+        {
+            p++;
+            if (match(p, F("TRACK"), 4))
+            {
+                return parseTracking(p, req);
+            }
+
+            // OUTPut:PROTection:CLEar and OUTPut:PROTection:TRIPped?
+            if (!match(p, F("PROTECTION"), 4) || *p++ != ':')
+            {
+                error(SCPI_UNDEFINED_HEADER);
+                return false;
+            }
+            if (match(p, F("CLEAR"), 3))
+            {
+                req.type = ScpiRequest::clearProtection;
+            }
+            else if (match(p, F("TRIPPED"), 4) && *p == '?')
+            {
+                req.type = ScpiRequest::getTripped;
+                p++;
+            }
+            else
+            {
+                error(SCPI_UNDEFINED_HEADER);
+                return false;
+            }
+            if (*skipSpace(p))
+            {
+                error(SCPI_COMMAND_ERROR);
+                return false;
+            }
+            return true;
+        }
+    }
+    else if (!measure && match(p, F("TELEMETRY"), 3))
+    {
+        req.type = ScpiRequest::setTelemetry;
+        boolArg = true;
+    }
+    else
+    {
+        error(SCPI_UNDEFINED_HEADER);
+        return false;
+    }
+
+    if (*p == '?')
+    {
+        if (*skipSpace(p + 1))
+        {
+            error(SCPI_COMMAND_ERROR);
+            return false;
+        }
+        if (req.type == ScpiRequest::setVoltage)
+        {
+            req.type = ScpiRequest::getVoltage;
+        }
+        else if (req.type == ScpiRequest::setCurrent)
+        {
+            req.type = ScpiRequest::getCurrent;
+        }
+        else if (req.type == ScpiRequest::setOutput)
+        {
+            req.type = ScpiRequest::getOutput;
+        }
+        else if (req.type == ScpiRequest::setTelemetry)
+        {
+            req.type = ScpiRequest::getTelemetry;
+        }
+        else if (req.type == ScpiRequest::setTrim)
+        {
+            req.type = ScpiRequest::getTrim;
+        }
+        else if (req.type == ScpiRequest::setOvp)
+        {
+            req.type = ScpiRequest::getOvp;
+        }
+        else if (req.type == ScpiRequest::setOcp)
+        {
+            req.type = ScpiRequest::getOcp;
+        }
+        return true;
+    }
+    if (measure || (*p != ' ' && *p != '\t'))
+    {
+        error(SCPI_COMMAND_ERROR);
+        return false;
+    }
+    p = skipSpace(p);
+    if (boolArg)
+    {
+        if (*p == '0' || *p == '1')
+        {
+            req.value = *p++ - '0';
+        }
+        else if (match(p, F("ON"), 2))
+        {
+            req.value = 1;
+        }
+        else if (match(p, F("OFF"), 3))
+        {
+            req.value = 0;
+        }
+        else
+        {
+            error(SCPI_DATA_TYPE_ERROR);
+            return false;
+        }
+        if (*skipSpace(p))
+        {
+            error(SCPI_DATA_TYPE_ERROR);
+            return false;
+        }
+        return true;
+    }
+    if (!parseMilli(p, req.value))
+    {
+        error(SCPI_DATA_TYPE_ERROR);
+        return false;
+    }
+    return true;
+}
+
+// CALibration:VOLTage, CALibration:CURRent, CALibration:REFerence <value>,
+// CALibration:ABORt and CALibration:STATe?
+bool Scpi::parseCalibration(const char *p, ScpiRequest &req)
+{
+    if (*p++ != ':')
+    {
+        error(SCPI_UNDEFINED_HEADER);
+        return false;
+    }
+    if (match(p, F("VOLTAGE"), 4))
+    {
+        req.type = ScpiRequest::startCalVoltage;
+    }
+    else if (match(p, F("CURRENT"), 4))
+    {
+        req.type = ScpiRequest::startCalCurrent;
+    }
+    else if (match(p, F("ABORT"), 4))
+    {
+        req.type = ScpiRequest::abortCal;
+    }
+    else if (match(p, F("STATE"), 4))
+    {
+        req.type = ScpiRequest::getCalState;
+        if (*p++ != '?')
+        {
+            error(SCPI_COMMAND_ERROR);
+            return false;
+        }
+    }
+    else if (match(p, F("REFERENCE"), 3))
+    {
+        req.type = ScpiRequest::setCalReference;
+        if (*p != ' ' && *p != '\t')
+        {
+            error(SCPI_COMMAND_ERROR);
+            return false;
+        }
+        if (!parseMilli(p, req.value))
+        {
+            error(SCPI_DATA_TYPE_ERROR);
+            return false;
+        }
+        return true;
+    }
+    else
+    {
+        error(SCPI_UNDEFINED_HEADER);
+        return false;
+    }
+    if (*skipSpace(p))
+    {
+        error(SCPI_COMMAND_ERROR);
+        return false;
+    }
+    return true;
+}
+
+// LIST:CLEar, LIST:POINt <v>,<a>,<ms>, LIST:RAMP <v>,<a>,<ms>, LIST:COUNt <n>,
+// LIST:COUNt?, LIST:POINt?, LIST:ARM, LIST:STARt, LIST:ABORt and LIST:STATe?
+bool Scpi::parseList(const char *p, ScpiRequest &req)
+{
+    if (*p++ != ':')
+    {
+        error(SCPI_UNDEFINED_HEADER);
+        return false;
+    }
+    bool ramp = false;
+    if (match(p, F("POINT"), 4) || (ramp = match(p, F("RAMP"), 4)))
+    {
+        req.type = ramp ? ScpiRequest::listRamp : ScpiRequest::listPoint;
+        if (!ramp && *p == '?')
+        {
+            req.type = ScpiRequest::getListPoints;
+            p++;
+        }
+        else if ((*p != ' ' && *p != '\t') || !parseDecimal(p, req.value) || *skipSpace(p) != ',' ||
+                 !parseDecimal(p = skipSpace(p) + 1, req.current) || *skipSpace(p) != ',' ||
+                 !parseDecimal(p = skipSpace(p) + 1, req.dwell))
+        {
+            error(SCPI_DATA_TYPE_ERROR);
+            return false;
+        }
+    }
+    else if (match(p, F("COUNT"), 4))
+    {
+        req.type = ScpiRequest::setListCount;
+        if (*p == '?')
+        {
+            req.type = ScpiRequest::getListCount;
+            p++;
+        }
+        else
+        {
+            p = skipSpace(p);
+            if (!isdigit(*p))
+            {
+                error(SCPI_DATA_TYPE_ERROR);
+                return false;
+            }
+            req.value = 0;
+            while (isdigit(*p) && req.value < 100000)
+            {
+                req.value = req.value * 10 + (*p++ - '0');
+            }
+        }
+    }
+    else if (match(p, F("CLEAR"), 3))
+    {
+        req.type = ScpiRequest::listClear;
+    }
+    else if (match(p, F("ARM"), 3))
+    {
+        req.type = ScpiRequest::listArm;
+    }
+    else if (match(p, F("START"), 4))
+    {
+        req.type = ScpiRequest::listStart;
+    }
+    else if (match(p, F("ABORT"), 4))
+    {
+        req.type = ScpiRequest::listAbort;
+    }
+    else if (match(p, F("STATE"), 4) && *p == '?')
+    {
+        req.type = ScpiRequest::getListState;
+        p++;
+    }
+    else
+    {
+        error(SCPI_UNDEFINED_HEADER);
+        return false;
+    }
+    if (*skipSpace(p))
+    {
+        error(SCPI_COMMAND_ERROR);
+        return false;
+    }
+    return true;
+}
+
+// METer?, METer:RESet, METer:HOLD ON|OFF, METer:HOLD? and METer:DISPlay ON|OFF
+bool Scpi::parseMeter(const char *p, ScpiRequest &req)
+{
+    bool hold = false;
+    if (*p == '?')
+    {
+        req.type = ScpiRequest::getMeter;
+        p++;
+    }
+    else if (*p++ != ':')
+    {
+        error(SCPI_UNDEFINED_HEADER);
+        return false;
+    }
+    else if (match(p, F("RESET"), 3))
+    {
+        req.type = ScpiRequest::resetMeter;
+    }
+    else if ((hold = match(p, F("HOLD"), 4)) || match(p, F("DISPLAY"), 4))
+    {
+        // Both take ON or OFF, and HOLD can be queried
+        req.type = hold ? ScpiRequest::setMeterHold : ScpiRequest::setMeterDisplay;
+        if (hold && *p == '?')
+        {
+            req.type = ScpiRequest::getMeterHold;
+            p++;
+        }
+        else
+        {
+            p = skipSpace(p);
+            if (*p == '0' || *p == '1')
+            {
+                req.value = *p++ - '0';
+            }
+            else if (match(p, F("ON"), 2))
+            {
+                req.value = 1;
+            }
+            else if (match(p, F("OFF"), 3))
+            {
+                req.value = 0;
+            }
+            else
+            {
+                error(SCPI_DATA_TYPE_ERROR);
+                return false;
+            }
+        }
+    }
+    else
+    {
+        error(SCPI_UNDEFINED_HEADER);
+        return false;
+    }
+    if (*skipSpace(p))
+    {
+        error(SCPI_COMMAND_ERROR);
+        return false;
+    }
+    return true;
+}
+
+// INSTrument:NSELect <n> and INSTrument:NSELect?, channels counting from 1
+bool Scpi::parseInstrument(const char *p, ScpiRequest &req)
+{
+    if (*p++ != ':' || !match(p, F("NSELECT"), 4))
+    {
+        error(SCPI_UNDEFINED_HEADER);
+        return false;
+    }
+    if (*p == '?')
+    {
+        req.type = ScpiRequest::getChannel;
+        p++;
+    }
+    else
+    {
+        req.type = ScpiRequest::selectChannel;
+        p = skipSpace(p);
+        if (!isdigit(*p))
+        {
+            error(SCPI_DATA_TYPE_ERROR);
+            return false;
+        }
+        req.value = 0;
+        while (isdigit(*p) && req.value < 100)
+        {
+            req.value = req.value * 10 + (*p++ - '0');
+        }
+    }
+    if (*skipSpace(p))
+    {
+        error(SCPI_COMMAND_ERROR);
+        return false;
+    }
+    return true;
+}
+
+// OUTPut:TRACk OFF|SERies|MIRRor and OUTPut:TRACk?, after the TRACk
+bool Scpi::parseTracking(const char *p, ScpiRequest &req)
+{
+    if (*p == '?')
+    {
+        req.type = ScpiRequest::getTracking;
+        p++;
+    }
+    else
+    {
+        req.type = ScpiRequest::setTracking;
+        p = skipSpace(p);
+        if (*p == '0')
+        {
+            p++;
+            req.value = SCPI_TRACK_OFF;
+        }
+        else if (match(p, F("OFF"), 3))
+        {
+            req.value = SCPI_TRACK_OFF;
+        }
+        else if (match(p, F("SERIES"), 3))
+        {
+            req.value = SCPI_TRACK_SERIES;
+        }
+        else if (match(p, F("MIRROR"), 4))
+        {
+            req.value = SCPI_TRACK_MIRROR;
+        }
+        else
+        {
+            error(SCPI_DATA_TYPE_ERROR);
+            return false;
+        }
+    }
+    if (*skipSpace(p))
+    {
+        error(SCPI_COMMAND_ERROR);
+        return false;
+    }
+    return true;
+}
+
+#ifdef PROFILE
+// DIAGnostic:TIMing? <section>, DIAGnostic:HISTogram? <section>,
+// DIAGnostic:TASK? <task>, DIAGnostic:RESet, DIAGnostic:DISPlay ON|OFF and DIAGnostic:MEMory?
+bool Scpi::parseDiagnostic(const char *p, ScpiRequest &req)
+{
+    if (*p++ != ':')
+    {
+        error(SCPI_UNDEFINED_HEADER);
+        return false;
+    }
+    bool query = true;
+    if (match(p, F("TIMING"), 3))
+    {
+        req.type = ScpiRequest::getTiming;
+    }
+    else if (match(p, F("HISTOGRAM"), 4))
+    {
+        req.type = ScpiRequest::getHistogram;
+    }
+    else if (match(p, F("TASK"), 4))
+    {
+        req.type = ScpiRequest::getTask;
+    }
+    else if (match(p, F("RESET"), 3))
+    {
+        req.type = ScpiRequest::resetTiming;
+        query = false;
+    }
+    else if (match(p, F("DISPLAY"), 4))
+    {
+        req.type = ScpiRequest::setDiagDisplay;
+        query = false;
+    }
+    else if (match(p, F("MEMORY"), 3))
+    {
+        req.type = ScpiRequest::getMemory;
+    }
+    else
+    {
+        error(SCPI_UNDEFINED_HEADER);
+        return false;
+    }
+
+    if (req.type == ScpiRequest::resetTiming || req.type == ScpiRequest::getMemory)
+    {
+        if (req.type == ScpiRequest::getMemory && *p++ != '?')
+        {
+            error(SCPI_COMMAND_ERROR);
+            return false;
+        }
+        if (*skipSpace(p))
+        {
+            error(SCPI_COMMAND_ERROR);
+            return false;
+        }
+        return true;
+    }
+    if (query != (*p == '?'))
+    {
+        error(SCPI_COMMAND_ERROR);
+        return false;
+    }
+    p = skipSpace(query ? p + 1 : p);
+    if (query)
+    {
+        if (!isdigit(*p))
+        {
+            error(SCPI_DATA_TYPE_ERROR);
+            return false;
+        }
+        req.value = 0;
+        while (isdigit(*p) && req.value < 100)
+        {
+            req.value = req.value * 10 + (*p++ - '0');
+        }
+    }
+    else if (match(p, F("ON"), 2))
+    {
+        req.value = 1;
+    }
+    else if (match(p, F("OFF"), 3))
+    {
+        req.value = 0;
+    }
+    else
+    {
+        error(SCPI_DATA_TYPE_ERROR);
+        return false;
+    }
+    if (*skipSpace(p))
+    {
+        error(SCPI_DATA_TYPE_ERROR);
+        return false;
+    }
+    return true;
+}
+#endif
+
+void Scpi::reply(const char *s)
+{
+    uint8_t n = strlen(s);
+    char *dst = startReply(n);
+    if (dst)
+    {
+        memcpy(dst, s, n);
+        endReply(n);
+    }
+}
+
+void Scpi::reply(const hal::FlashString *s)
+{
+    uint8_t n = strlen_P((const char *)s);
+    char *dst = startReply(n);
+    if (dst)
+    {
+        memcpy_P(dst, s, n);
+        endReply(n);
+    }
+}
+
+char *Scpi::startReply(uint8_t n)
+{
+    if (outPos == outLen)
+    {
+        outPos = 0;
+        outLen = 0;
+    }
+    if (outLen + n + 1 > SCPI_OUT_MAX)
+    {
+        // The host isn't reading its replies
+        error(SCPI_QUERY_INTERRUPTED);
+        return nullptr;
+    }
+    return out + outLen;
+}
+
+void Scpi::endReply(uint8_t n)
+{
+    outLen += n;
+    out[outLen++] = '\n';
+    flush();
+}
+
+void Scpi::replyMilli(int32_t v)
+{
+    char buf[16];
+    char *p = buf;
+    if (v < 0)
+    {
+        *p++ = '-';
+        v = -v;
+    }
+    snprintf_P(p, buf + sizeof(buf) - p, PSTR("%ld.%03ld"), (long)(v / 1000), (long)(v % 1000));
+    reply(buf);
+}
+
+void Scpi::replyBool(bool b)
+{
+    reply(b ? F("1") : F("0"));
+}
+
+void Scpi::error(int16_t code)
+{
+    if (errorCount < SCPI_ERROR_MAX)
+    {
+        errors[errorCount++] = code;
+    }
+    else
+    {
+        errors[SCPI_ERROR_MAX - 1] = SCPI_QUEUE_OVERFLOW;
+    }
+}
+
+void Scpi::flush()
+{
+    if (outPos == outLen)
+    {
+        return;
+    }
+    int room = hal::serialAvailableForWrite();
+    if (room <= 0)
+    {
+        return;
+    }
+    uint8_t n = min(room, outLen - outPos);
+    hal::serialWrite((const uint8_t *)out + outPos, n);
+    outPos += n;
+}
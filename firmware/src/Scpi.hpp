@@ -0,0 +1,175 @@
+/*
+Copyright 2023, Pontus Rydin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in
+the Software without restriction, including without limitation the rights to use,
+copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef __SCPI_HPP
+#define __SCPI_HPP
+#include "Hal.hpp"
+
+#define SCPI_LINE_MAX 48   // Longest command line accepted
+#ifdef PROFILE
+#define SCPI_OUT_MAX 96 // Room for a full histogram reply
+#else
+#define SCPI_OUT_MAX 64 // Replies waiting to be sent
+#endif
+#define SCPI_ERROR_MAX 4   // Depth of the error queue
+#define SCPI_POLL_BYTES 32 // Maximum bytes read per call to poll()
+
+// SCPI error codes
+#define SCPI_COMMAND_ERROR -100
+#define SCPI_DATA_TYPE_ERROR -104
+#define SCPI_TRIGGER_IGNORED -211
+#define SCPI_UNDEFINED_HEADER -113
+#define SCPI_SETTINGS_CONFLICT -221
+#define SCPI_DATA_OUT_OF_RANGE -222
+#define SCPI_TOO_MUCH_DATA -223
+#define SCPI_QUEUE_OVERFLOW -350
+#define SCPI_INPUT_OVERRUN -363
+#define SCPI_QUERY_INTERRUPTED -410
+
+// OUTPut:TRACk modes, in ScpiRequest::value
+#define SCPI_TRACK_OFF 0
+#define SCPI_TRACK_SERIES 1
+#define SCPI_TRACK_MIRROR 2
+
+// A parsed command that needs the rest of the firmware to act on it. *IDN?
+// and SYST:ERR? are answered by the parser itself.
+struct ScpiRequest
+{
+    enum Type
+    {
+        setVoltage,
+        getVoltage,
+        setCurrent,
+        getCurrent,
+        measVoltage,
+        measCurrent,
+        measTemperature,
+        measFan,
+        setOutput,
+        getOutput,
+        setTelemetry,
+        getTelemetry,
+        setTrim,
+        getTrim,
+        setOvp,
+        getOvp,
+        setOcp,
+        getOcp,
+        clearProtection,
+        getTripped,
+        startCalVoltage,
+        startCalCurrent,
+        setCalReference,
+        abortCal,
+        getCalState,
+        listClear,
+        listPoint,
+        listRamp,
+        setListCount,
+        getListCount,
+        getListPoints,
+        listArm,
+        listStart,
+        listTrigger,
+        listAbort,
+        getListState,
+        getMeter,
+        resetMeter,
+        setMeterHold,
+        getMeterHold,
+        setMeterDisplay,
+        selectChannel,
+        getChannel,
+        setTracking,
+        getTracking,
+#ifdef PROFILE
+        getTiming,
+        getHistogram,
+        getTask,
+        resetTiming,
+        setDiagDisplay,
+        getMemory
+#endif
+    };
+
+    Type type;
+    int32_t value; // Millivolts or milliamps, 0/1 for on/off settings, a channel (from 1), a SCPI_TRACK mode or a profile section
+    int32_t current; // LIST:POINt and LIST:RAMP only: milliamps, with value the millivolts
+    int32_t dwell;   // and the time at the point in microseconds
+};
+
+// Incremental, allocation free parser for a small SCPI subset on the serial
+// port. Call poll() from loop(); it never blocks on either direction.
+class Scpi
+{
+public:
+    // Reads what's available (up to SCPI_POLL_BYTES) and sends pending
+    // replies. Returns true with req filled in when a command needs handling.
+    bool poll(ScpiRequest &req);
+
+    void reply(const char *s);
+
+    void reply(const hal::FlashString *s);
+
+    void replyMilli(int32_t v);
+
+    void replyBool(bool b);
+
+    void error(int16_t code);
+
+private:
+    char line[SCPI_LINE_MAX];
+    uint8_t lineLen = 0;
+    bool overrun = false;
+
+    char out[SCPI_OUT_MAX];
+    uint8_t outLen = 0;
+    uint8_t outPos = 0;
+
+    int16_t errors[SCPI_ERROR_MAX];
+    uint8_t errorCount = 0;
+
+    bool parse(ScpiRequest &req);
+
+    // Room for a reply of n characters in the output buffer, or nullptr
+    // (and an error) if the host isn't reading. Finish with endReply().
+    char *startReply(uint8_t n);
+
+    void endReply(uint8_t n);
+
+    bool parseCalibration(const char *p, ScpiRequest &req);
+
+    bool parseList(const char *p, ScpiRequest &req);
+
+    bool parseMeter(const char *p, ScpiRequest &req);
+
+    bool parseInstrument(const char *p, ScpiRequest &req);
+
+    bool parseTracking(const char *p, ScpiRequest &req);
+
+#ifdef PROFILE
+    bool parseDiagnostic(const char *p, ScpiRequest &req);
+#endif
+
+    void flush();
+};
+#endif
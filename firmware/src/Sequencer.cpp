@@ -0,0 +1,157 @@
+#include "Sequencer.hpp"
+
+void Sequencer::clear()
+{
+    abort();
+    count = 0;
+}
+
+bool Sequencer::add(uint16_t volt, uint16_t amp, uint32_t ticks, bool ramp)
+{
+    if (count >= LIST_MAX_POINTS || isActive())
+    {
+        return false;
+    }
+    ListPoint &p = points[count++];
+    p.volt = volt;
+    p.amp = amp;
+    p.ticks = ticks ? ticks : 1;
+    p.ramp = ramp;
+    return true;
+}
+
+void Sequencer::setAmpLimit(uint16_t code)
+{
+    uint8_t s = hal::disableInterrupts();
+    limitChanged = code != ampLimit;
+    ampLimit = code;
+    hal::restoreInterrupts(s);
+}
+
+bool Sequencer::arm(bool start, uint16_t voltCode, uint16_t ampCode)
+{
+    if (count == 0)
+    {
+        return false;
+    }
+    uint8_t s = hal::disableInterrupts();
+    volt = (int32_t)voltCode << 16;
+    amp = (int32_t)ampCode << 16;
+    state = armed;
+    starting = start;
+    stopped = false;
+    hal::restoreInterrupts(s);
+    return true;
+}
+
+bool Sequencer::trigger()
+{
+    uint8_t s = hal::disableInterrupts();
+    bool ok = state == armed;
+    starting |= ok;
+    hal::restoreInterrupts(s);
+    return ok;
+}
+
+void Sequencer::abort()
+{
+    uint8_t s = hal::disableInterrupts();
+    if (isActive())
+    {
+        stop(aborted);
+    }
+    hal::restoreInterrupts(s);
+}
+
+bool Sequencer::takeStop()
+{
+    uint8_t s = hal::disableInterrupts();
+    bool b = stopped;
+    stopped = false;
+    hal::restoreInterrupts(s);
+    return b;
+}
+
+uint16_t Sequencer::getPass()
+{
+    uint8_t s = hal::disableInterrupts();
+    uint16_t p = pass;
+    hal::restoreInterrupts(s);
+    return p;
+}
+
+// Sets up point i. A ramp starts from wherever the output is, which for the
+// first point is what was on the DAC when the list was armed, or the last
+// point on a repeat. The one division per ramp is all the interrupt ever does.
+void Sequencer::enter(uint8_t i)
+{
+    const ListPoint &p = points[i];
+    point = i;
+    if (p.ramp)
+    {
+        voltStep = (((int32_t)p.volt << 16) - volt) / (int32_t)p.ticks;
+        ampStep = (((int32_t)p.amp << 16) - amp) / (int32_t)p.ticks;
+    }
+    else
+    {
+        volt = (int32_t)p.volt << 16;
+        amp = (int32_t)p.amp << 16;
+        voltStep = 0;
+        ampStep = 0;
+    }
+    left = p.ticks;
+}
+
+bool Sequencer::tick(uint16_t &voltCode, uint16_t &ampCode)
+{
+    if (state == armed && starting)
+    {
+        starting = false;
+        state = running;
+        pass = 1;
+        enter(0);
+    }
+    else if (state != running)
+    {
+        return false;
+    }
+    else if (left == 0)
+    {
+        if (point + 1 < count)
+        {
+            enter(point + 1);
+        }
+        else if (repeat == 0 || pass < repeat)
+        {
+            pass++;
+            enter(0);
+        }
+        else
+        {
+            // Hand the DAC back to loop()
+            stop(done);
+            return false;
+        }
+    }
+
+    bool changed = left == points[point].ticks || voltStep || ampStep || limitChanged;
+    limitChanged = false;
+    if (--left == 0 && points[point].ramp)
+    {
+        // Land exactly on the point, whatever the rounding of the steps
+        volt = (int32_t)points[point].volt << 16;
+        amp = (int32_t)points[point].amp << 16;
+    }
+    else
+    {
+        volt += voltStep;
+        amp += ampStep;
+    }
+    if (changed)
+    {
+        voltCode = volt >> 16;
+        ampCode = amp >> 16;
+        ampCode = ampCode < ampLimit ? ampCode : ampLimit;
+    }
+    return changed;
+}
@@ -0,0 +1,145 @@
+/*
+Copyright 2023, Pontus Rydin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in
+the Software without restriction, including without limitation the rights to use,
+copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef __SEQUENCER_HPP
+#define __SEQUENCER_HPP
+#include "Hal.hpp"
+
+#define LIST_MAX_POINTS 16 // Points in a list
+
+// One point of a list, in DAC codes and sampling ticks
+struct ListPoint
+{
+    uint16_t volt;
+    uint16_t amp;
+    uint32_t ticks; // How long the point lasts
+    bool ramp;      // Ramp linearly from the previous output over the point, rather than step to it
+};
+
+// Steps the DAC through a list of points from the sampling interrupt, so the
+// timing only depends on the hardware timer and not on loop(). Ramps are
+// computed with 16.16 fixed point codes, updated on every tick. The list
+// itself is built and started from loop(); tick() is the only thing that
+// runs in the interrupt.
+class Sequencer
+{
+public:
+    enum State
+    {
+        idle,
+        armed,   // Waiting for trigger()
+        running,
+        done,    // Ran all its passes
+        aborted  // Stopped by abort(), a trip or a conflicting setting
+    };
+
+    // Empties the list, stopping it if it runs
+    void clear();
+
+    // Appends a point. Returns false when the list is full or active.
+    bool add(uint16_t volt, uint16_t amp, uint32_t ticks, bool ramp);
+
+    uint8_t getPoints()
+    {
+        return count;
+    }
+
+    // Passes through the list, 0 to repeat until aborted
+    void setRepeat(uint16_t n)
+    {
+        repeat = n;
+    }
+
+    uint16_t getRepeat()
+    {
+        return repeat;
+    }
+
+    // Ceiling for the current code, for the current derating. Safe to call while running.
+    void setAmpLimit(uint16_t code);
+
+    // Waits for trigger(), or starts right away. volt and amp are the codes
+    // on the DAC now, which a ramp at the first point starts from. Returns
+    // false for an empty list.
+    bool arm(bool start, uint16_t volt, uint16_t amp);
+
+    // Starts an armed list at the next tick. Returns false if it wasn't armed.
+    bool trigger();
+
+    // Stops the list. Also safe to call from the sampling interrupt.
+    void abort();
+
+    // Call from the sampling interrupt, before anything else. Returns true
+    // with the codes to write when the output changes.
+    bool tick(uint16_t &volt, uint16_t &amp);
+
+    // True while armed or running. The list owns the DAC until it stops.
+    bool isActive()
+    {
+        return state == armed || state == running;
+    }
+
+    // Returns true once after the list has stopped, for loop() to put the
+    // setpoints back on the DAC
+    bool takeStop();
+
+    State getState()
+    {
+        return state;
+    }
+
+    uint8_t getPoint()
+    {
+        return point;
+    }
+
+    // Passes started so far
+    uint16_t getPass();
+
+private:
+    ListPoint points[LIST_MAX_POINTS];
+    uint8_t count = 0;
+    uint16_t repeat = 1;
+    volatile State state = idle;
+    volatile bool stopped = false;
+    volatile bool starting = false;
+    uint16_t ampLimit = 0xffff;
+    volatile bool limitChanged = false;
+
+    // Position, only touched by tick() while running
+    volatile uint8_t point = 0;
+    uint16_t pass = 0;
+    uint32_t left = 0;  // Ticks left at the current point
+    int32_t volt = 0;   // Output, in 16.16 codes
+    int32_t amp = 0;
+    int32_t voltStep = 0;
+    int32_t ampStep = 0;
+
+    void enter(uint8_t i);
+
+    void stop(State s)
+    {
+        state = s;
+        stopped = true;
+    }
+};
+#endif
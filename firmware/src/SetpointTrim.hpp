@@ -0,0 +1,134 @@
+/*
+Copyright 2023, Pontus Rydin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in
+the Software without restriction, including without limitation the rights to use,
+copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef __SETPOINT_TRIM_HPP
+#define __SETPOINT_TRIM_HPP
+#include <stdint.h>
+
+#define TRIM_FRAC_BITS 8   // Fractional bits of the correction, in DAC codes
+#define TRIM_GAIN_SHIFT 2  // Integral gain. 1/2^n of the error is corrected per update
+#define TRIM_LIMIT 32      // Largest correction, in DAC codes
+#define TRIM_MAX_ERROR 250 // Larger errors (mV) mean the output isn't following the DAC
+#define TRIM_SETTLE 2      // Updates skipped after the setpoint changes
+
+// Slow outer loop that trims a DAC output so that a calibrated reading of it
+// matches the setpoint. The correction is a pure integral term kept with
+// TRIM_FRAC_BITS of sub-LSB resolution, so noise averages out over several
+// updates and the correction only moves the DAC when it crosses a whole code.
+//
+// The integrator stops (but keeps its value) whenever it can't do any good:
+// while the caller holds it, e.g. in current limit, while the output settles
+// after a setpoint change, when the error is too large to be drift, and when
+// the correction or the DAC is already at its limit (anti-windup).
+class SetpointTrim
+{
+public:
+    // maxCode is the DAC code corresponding to fullScale (in mV)
+    SetpointTrim(uint16_t maxCode, uint16_t fullScale) : maxCode(maxCode), fullScale(fullScale)
+    {
+    }
+
+    void setEnabled(bool on)
+    {
+        enabled = on;
+        integral = 0;
+    }
+
+    bool isEnabled()
+    {
+        return enabled;
+    }
+
+    void setpointChanged()
+    {
+        settle = TRIM_SETTLE;
+    }
+
+    // Feeds one reading of the output. Returns true if the correction changed
+    // by at least one DAC code, in which case the DAC should be rewritten.
+    bool update(int32_t setpoint, int32_t measured, bool hold)
+    {
+        if (!enabled || hold)
+        {
+            return false;
+        }
+        if (settle > 0)
+        {
+            settle--;
+            return false;
+        }
+        int32_t error = setpoint - measured;
+        if (error > TRIM_MAX_ERROR || error < -TRIM_MAX_ERROR)
+        {
+            return false;
+        }
+        if ((error > 0 && saturated > 0) || (error < 0 && saturated < 0))
+        {
+            return false;
+        }
+        int16_t before = getTrim();
+        integral += (error * maxCode * (1 << TRIM_FRAC_BITS)) / fullScale >> TRIM_GAIN_SHIFT;
+        const int32_t limit = (int32_t)TRIM_LIMIT << TRIM_FRAC_BITS;
+        if (integral > limit)
+        {
+            integral = limit;
+        }
+        else if (integral < -limit)
+        {
+            integral = -limit;
+        }
+        return getTrim() != before;
+    }
+
+    // Correction in whole DAC codes
+    int16_t getTrim()
+    {
+        return (integral + (1 << (TRIM_FRAC_BITS - 1))) >> TRIM_FRAC_BITS;
+    }
+
+    // Applies the correction to an untrimmed DAC code
+    uint16_t apply(uint16_t code)
+    {
+        int32_t trimmed = (int32_t)code + getTrim();
+        saturated = 0;
+        if (trimmed >= maxCode)
+        {
+            saturated = 1;
+            return maxCode;
+        }
+        if (trimmed <= 0)
+        {
+            saturated = -1;
+            return 0;
+        }
+        return trimmed;
+    }
+
+private:
+    uint16_t maxCode;
+    uint16_t fullScale;
+    bool enabled = true;
+    int32_t integral = 0; // Correction in DAC codes, with TRIM_FRAC_BITS fractional bits
+    uint8_t settle = 0;
+    int8_t saturated = 0; // Sign of the limit the last trimmed code was clamped to
+};
+#endif
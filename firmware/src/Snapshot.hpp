@@ -0,0 +1,74 @@
+/*
+Copyright 2023, Pontus Rydin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in
+the Software without restriction, including without limitation the rights to use,
+copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef __SNAPSHOT_HPP
+#define __SNAPSHOT_HPP
+#include "Hal.hpp"
+
+// Sequence counted snapshot of a value too large to be written atomically.
+// The writer bumps the sequence number to odd before writing and back to even
+// after, and readers retry if it was odd or changed while they copied.
+//
+// The writer must never be interrupted by a reader spinning in read(), so
+// readers in interrupt context must use tryRead() instead.
+template <class T>
+class Snapshot
+{
+public:
+    void write(const T &v)
+    {
+        seq++;
+        __asm__ __volatile__("" ::: "memory");
+        value = v;
+        __asm__ __volatile__("" ::: "memory");
+        seq++;
+    }
+
+    bool tryRead(T &v) const
+    {
+        uint8_t before = seq;
+        __asm__ __volatile__("" ::: "memory");
+        v = value;
+        __asm__ __volatile__("" ::: "memory");
+        return !(before & 1) && before == seq;
+    }
+
+    T read() const
+    {
+        T v;
+        while (!tryRead(v))
+        {
+        }
+        return v;
+    }
+
+    // Changes every time a new value is written
+    uint8_t getSequence() const
+    {
+        return seq;
+    }
+
+private:
+    volatile uint8_t seq = 0;
+    T value = T();
+};
+#endif
@@ -0,0 +1,130 @@
+#include "Telemetry.hpp"
+
+static uint8_t *put16(uint8_t *p, uint16_t v)
+{
+    *p++ = v;
+    *p++ = v >> 8;
+    return p;
+}
+
+static bool fitsDelta(int32_t d)
+{
+    return d >= -128 && d <= 127;
+}
+
+void Telemetry::setEnabled(bool on)
+{
+    enabled = on;
+    ticks = 0;
+    ticksSinceFrame = 0;
+    decimation = 1;
+    count = 0;
+    sumVolt = 0;
+    sumAmp = 0;
+    seq = 0;
+    needKey = true;
+    goodFrames = 0;
+}
+
+bool Telemetry::addSample(uint16_t rawVolt, uint16_t rawAmp)
+{
+    if (!enabled)
+    {
+        return false;
+    }
+    ticks++;
+    ticksSinceFrame++;
+    sumVolt += rawVolt;
+    sumAmp += rawAmp;
+    if (++count < decimation)
+    {
+        return false;
+    }
+    frameVolt = sumVolt / count;
+    frameAmp = sumAmp / count;
+    sumVolt = 0;
+    sumAmp = 0;
+    count = 0;
+    return true;
+}
+
+void Telemetry::send(uint16_t volt, uint16_t amp, int16_t temp, uint16_t rpm)
+{
+    Values v = {frameVolt, frameAmp, volt, amp, temp, rpm};
+    int32_t dRawVolt = (int32_t)v.rawVolt - last.rawVolt;
+    int32_t dRawAmp = (int32_t)v.rawAmp - last.rawAmp;
+    int32_t dVolt = (int32_t)v.volt - last.volt;
+    int32_t dAmp = (int32_t)v.amp - last.amp;
+    int32_t dTemp = (int32_t)v.temp - last.temp;
+    int32_t dRpm = (int32_t)v.rpm - last.rpm;
+    bool key = needKey || sinceKey >= TELEMETRY_KEY_INTERVAL || ticksSinceFrame > 255 ||
+               !fitsDelta(dRawVolt) || !fitsDelta(dRawAmp) || !fitsDelta(dVolt) ||
+               !fitsDelta(dAmp) || !fitsDelta(dTemp) || !fitsDelta(dRpm);
+
+    uint8_t frame[TELEMETRY_KEY_SIZE];
+    uint8_t *p = frame;
+    *p++ = TELEMETRY_SYNC;
+    if (key)
+    {
+        uint32_t time = ticks * samplePeriod;
+        *p++ = TELEMETRY_KEY;
+        p = put16(p, seq);
+        p = put16(p, time);
+        p = put16(p, time >> 16);
+        p = put16(p, v.rawVolt);
+        p = put16(p, v.rawAmp);
+        p = put16(p, v.volt);
+        p = put16(p, v.amp);
+        p = put16(p, v.temp);
+        p = put16(p, v.rpm);
+    }
+    else
+    {
+        *p++ = TELEMETRY_DELTA;
+        *p++ = seq;
+        *p++ = ticksSinceFrame;
+        *p++ = dRawVolt;
+        *p++ = dRawAmp;
+        *p++ = dVolt;
+        *p++ = dAmp;
+        *p++ = dTemp;
+        *p++ = dRpm;
+    }
+    seq++;
+    if (!write(frame, p - frame))
+    {
+        // The host isn't keeping up. Halve the frame rate and start over with a key frame.
+        if (decimation < TELEMETRY_MAX_DECIMATION)
+        {
+            decimation <<= 1;
+        }
+        needKey = true;
+        goodFrames = 0;
+        return;
+    }
+    last = v;
+    ticksSinceFrame = 0;
+    sinceKey = key ? 1 : sinceKey + 1;
+    needKey = false;
+    if (decimation > 1 && ++goodFrames >= TELEMETRY_RECOVER_FRAMES)
+    {
+        decimation >>= 1;
+        goodFrames = 0;
+    }
+}
+
+bool Telemetry::write(uint8_t *frame, uint8_t n)
+{
+    if (hal::serialAvailableForWrite() < n + 1)
+    {
+        return false;
+    }
+    uint8_t crc = 0;
+    for (uint8_t i = 1; i < n; i++)
+    {
+        crc = telemetryCrc(crc, frame[i]);
+    }
+    frame[n] = crc;
+    hal::serialWrite(frame, n + 1);
+    return true;
+}
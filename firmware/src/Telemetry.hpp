@@ -0,0 +1,100 @@
+/*
+Copyright 2023, Pontus Rydin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in
+the Software without restriction, including without limitation the rights to use,
+copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef __TELEMETRY_HPP
+#define __TELEMETRY_HPP
+#include "Hal.hpp"
+#include "TelemetryFormat.hpp"
+
+#define TELEMETRY_MAX_DECIMATION 128
+#define TELEMETRY_RECOVER_FRAMES 512 // Frames sent in a row before decimation is halved again
+
+// Streams binary telemetry frames (see TelemetryFormat.hpp) over the serial
+// port, one per voltage/current sample pair. A frame is only written if it
+// fits in the serial buffer right away. When the host falls behind, frames
+// are dropped and the stream decimates, averaging the raw codes over each
+// frame period, until the host keeps up again.
+class Telemetry
+{
+public:
+    Telemetry(uint16_t samplePeriod) : samplePeriod(samplePeriod)
+    {
+    }
+
+    void setEnabled(bool on);
+
+    bool isEnabled()
+    {
+        return enabled;
+    }
+
+    // Adds a sample pair. Returns true when a frame is due, in which case the
+    // caller converts getRawVolt()/getRawAmp() and calls send().
+    bool addSample(uint16_t rawVolt, uint16_t rawAmp);
+
+    uint16_t getRawVolt()
+    {
+        return frameVolt;
+    }
+
+    uint16_t getRawAmp()
+    {
+        return frameAmp;
+    }
+
+    void send(uint16_t volt, uint16_t amp, int16_t temp, uint16_t rpm);
+
+    uint8_t getDecimation()
+    {
+        return decimation;
+    }
+
+private:
+    struct Values
+    {
+        uint16_t rawVolt;
+        uint16_t rawAmp;
+        uint16_t volt;
+        uint16_t amp;
+        int16_t temp;
+        uint16_t rpm;
+    };
+
+    uint16_t samplePeriod; // Microseconds between sample pairs
+    bool enabled = false;
+    uint32_t ticks = 0;          // Sample pairs since the stream was started
+    uint16_t ticksSinceFrame = 0;
+    uint8_t decimation = 1;
+    uint8_t count = 0;
+    uint32_t sumVolt = 0;
+    uint32_t sumAmp = 0;
+    uint16_t frameVolt = 0;
+    uint16_t frameAmp = 0;
+    uint16_t seq = 0;
+    uint8_t sinceKey = 0;
+    bool needKey = true;
+    uint16_t goodFrames = 0;
+    Values last;
+
+    bool write(uint8_t *frame, uint8_t n);
+};
+#endif
@@ -0,0 +1,57 @@
+/*
+Copyright 2023, Pontus Rydin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in
+the Software without restriction, including without limitation the rights to use,
+copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef __TELEMETRY_FORMAT_HPP
+#define __TELEMETRY_FORMAT_HPP
+#include <stdint.h>
+#include "Crc.hpp"
+
+// Telemetry wire format, shared by the firmware and the host side decoder in
+// tools/. All multi-byte fields are little endian. Every frame is
+//
+//   TELEMETRY_SYNC, type, payload..., CRC-8 (poly 0x07) over type and payload
+//
+// Key frame (TELEMETRY_KEY), 21 bytes. Carries absolute values:
+//   u16 seq, u32 time (us since start), u16 raw voltage code, u16 raw current code,
+//   u16 millivolts, u16 milliamps, i16 centidegrees C, u16 fan RPM
+//
+// Delta frame (TELEMETRY_DELTA), 11 bytes. Carries differences from the previous frame:
+//   u8 seq (low byte), u8 time (in sample periods), i8 raw voltage, i8 raw current,
+//   i8 millivolts, i8 milliamps, i8 centidegrees, i8 RPM
+//
+// A key frame is sent whenever a difference doesn't fit in a delta frame,
+// every TELEMETRY_KEY_INTERVAL frames and after a frame has been dropped, so a
+// decoder can always resynchronize. Raw codes are averaged over the frame
+// period when the stream is decimated.
+
+#define TELEMETRY_SYNC 0xa5
+#define TELEMETRY_KEY 0x01
+#define TELEMETRY_DELTA 0x02
+#define TELEMETRY_KEY_SIZE 21
+#define TELEMETRY_DELTA_SIZE 11
+#define TELEMETRY_KEY_INTERVAL 64
+
+inline uint8_t telemetryCrc(uint8_t crc, uint8_t b)
+{
+    return crc8Update(crc, b);
+}
+#endif
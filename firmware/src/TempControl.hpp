@@ -20,12 +20,12 @@ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
 FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 OTHER DEALINGS IN THE SOFTWARE.
 */
-#include <Arduino.h>
-#include <FanController.h>
-#include <EEPROM.h>
+#include "Hal.hpp"
+#include "Profile.hpp"
 
-#define ABORT_THRESHOLD 100000    // Microseconds before we give up looking for a flank
-#define SPEED_CHECK_PERIOD 500000 // Microseconds between RPM checks
+#define SPEED_CHECK_PERIOD 500000  // Microseconds between RPM checks
+#define TACH_STALL_TIMEOUT 500000  // Microseconds without a tach pulse before the fan is considered stalled
+#define TACH_EDGES 8               // Tach pulses remembered. Must be a power of two
 
 class TempControl
 {
@@ -36,12 +36,23 @@ private:
     float maxTemp;
     float slope;
     bool failsafe = false;
+    uint8_t currentSpeed = 0;
     uint16_t cachedSpeed = 0;
     uint32_t lastSpeedReading = 0;
+    uint32_t lastSpeedChange = 0;
+
+    // Timestamps of the most recent tach pulses, written by onTachPulse()
+    volatile uint32_t edges[TACH_EDGES];
+    volatile uint8_t edgeCount = 0;
 
     void setSpeed(uint8_t speed)
     {
-        analogWrite(pwmPin, speed);
+        if (speed != currentSpeed)
+        {
+            currentSpeed = speed;
+            lastSpeedChange = hal::micros();
+        }
+        hal::writePwm(pwmPin, speed);
     }
 
 public:
@@ -49,8 +60,21 @@ public:
     {
     }
 
-    void begin()
+    // tachIsr must call onTachPulse()
+    void begin(void (*tachIsr)())
+    {
+        hal::attachPinInterrupt(sensePin, tachIsr, RISING);
+    }
+
+    // Called from the tach pin interrupt once per fan period
+    void onTachPulse()
     {
+        uint8_t n = edgeCount;
+        edges[n & (TACH_EDGES - 1)] = hal::micros();
+
+        // Skip zero on wraparound so a full buffer is never mistaken for an empty one
+        n++;
+        edgeCount = n ? n : TACH_EDGES;
     }
 
     void setTemp(float t)
@@ -72,7 +96,8 @@ public:
 
     uint16_t getCachedSpeed()
     {
-        uint32_t now = micros();
+        PROFILE_SCOPE(profileFanSpeed);
+        uint32_t now = hal::micros();
         if (now - lastSpeedReading > SPEED_CHECK_PERIOD)
         {
             lastSpeedReading = now;
@@ -81,44 +106,44 @@ public:
         return cachedSpeed;
     }
 
+    // Returns the RPM averaged over the last TACH_EDGES pulses. Never blocks.
     uint16_t getSpeed()
     {
-        // Simplistic algorithm not using interrupts. Good enough for 5% precision
-        // and no risk of disturbing other things requiring interrupts.
-        //
-        // Wait for a transition. It doesn't matter if it's positive or negative
-        uint8_t state = digitalRead(sensePin);
-        uint32_t start = micros();
-        while (digitalRead(sensePin) == state)
+        uint8_t sreg = hal::disableInterrupts();
+        uint8_t n = edgeCount;
+        uint32_t last = edges[(n - 1) & (TACH_EDGES - 1)];
+        uint32_t first = edges[n & (TACH_EDGES - 1)];
+        hal::restoreInterrupts(sreg);
+
+        // Too few pulses to say anything, or the fan has stopped
+        uint32_t now = hal::micros();
+        if (n < TACH_EDGES || now - last > TACH_STALL_TIMEOUT)
         {
-            if (micros() - start > ABORT_THRESHOLD)
-            {
-                return 0;
-            }
+            return 0;
         }
+        uint32_t period = (last - first) / (TACH_EDGES - 1);
 
-        // Find the opposite flank.
-        start = micros();
-        while (digitalRead(sensePin) != state)
+        // If the fan is slowing down, the time since the last pulse is a better estimate
+        if (now - last > period)
         {
-            if (micros() - start > ABORT_THRESHOLD)
-            {
-                return 0;
-            }
+            period = now - last;
         }
+        return period ? 60000000UL / period : 0;
+    }
 
-        // Finally look for a flank that takes us back to the initial state.
-        // We've now completed a perios.
-        while (digitalRead(sensePin) == state)
+    // True if the fan has been told to run but no tach pulses have arrived
+    // within TACH_STALL_TIMEOUT.
+    bool isStalled()
+    {
+        uint32_t now = hal::micros();
+        if (currentSpeed == 0 || now - lastSpeedChange < TACH_STALL_TIMEOUT)
         {
-            if (micros() - start > ABORT_THRESHOLD)
-            {
-                return 0;
-            }
+            return false;
         }
-        uint32_t now = micros();
-        uint32_t period = now - start;
-        uint16_t speed = 60.0e6 / (float)period;
-        return speed;
+        uint8_t sreg = hal::disableInterrupts();
+        uint8_t n = edgeCount;
+        uint32_t last = edges[(n - 1) & (TACH_EDGES - 1)];
+        hal::restoreInterrupts(sreg);
+        return n == 0 || now - last > TACH_STALL_TIMEOUT;
     }
 };
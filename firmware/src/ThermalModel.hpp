@@ -0,0 +1,115 @@
+/*
+Copyright 2023, Pontus Rydin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in
+the Software without restriction, including without limitation the rights to use,
+copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef __THERMAL_MODEL_HPP
+#define __THERMAL_MODEL_HPP
+#include "Hal.hpp"
+
+#define THERMAL_CORRECTION 0.05 // Fraction of the difference to the thermistor taken out per update
+#define THERMAL_HORIZON 60.0    // Seconds ahead the allowed power keeps the junction under its target
+
+// Parameters of the lumped model. The heatsink ones can be fitted from a
+// logged heat-soak run with tools/thermal_fit.cpp. The junction ones come
+// from the transistor datasheet and the insulating pad.
+struct ThermalParams
+{
+    float capacity;    // Heat capacity of the heatsink (J/K)
+    float gStill;      // Heatsink to air conductance with the fan stopped (W/K)
+    float gPerKrpm;    // Conductance added per 1000 RPM of fan speed (W/K)
+    float rJunction;   // Junction to heatsink (K/W)
+    float tauJunction; // Time constant of the junction over the heatsink (s)
+    float ambient;     // Air temperature (C)
+};
+
+// Two node RC model of the pass transistor: the junction sits rJunction
+// above the heatsink, and the heatsink is a heat capacity losing heat to the
+// air through a conductance that grows with the fan speed. The heatsink
+// temperature is predicted from the dissipated power and pulled towards the
+// thermistor reading, so the model can't drift far from reality while the
+// junction, which can't be measured, still follows the power right away.
+//
+// getAllowedPower() is the constant power that brings the junction to the
+// target temperature THERMAL_HORIZON seconds from now. It shrinks smoothly as
+// the heatsink warms up, which makes it suitable for derating the output
+// well before the heatsink gets anywhere near its hard limit.
+class ThermalModel
+{
+public:
+    ThermalModel(const ThermalParams &params) : p(params)
+    {
+    }
+
+    // Starts the model out at the thermistor temperature
+    void begin(float sinkTemp)
+    {
+        sink = sinkTemp;
+        rise = 0;
+        started = true;
+    }
+
+    // Advances the model by dt seconds at the given dissipation (W), heatsink
+    // reading (C) and fan speed
+    void update(float dt, float power, float sinkTemp, uint16_t rpm)
+    {
+        if (!started)
+        {
+            begin(sinkTemp);
+        }
+        float g = getConductance(rpm);
+        sink += dt * (power - g * (sink - p.ambient)) / p.capacity;
+        sink += (sinkTemp - sink) * THERMAL_CORRECTION;
+        float k = dt < p.tauJunction ? dt / p.tauJunction : 1;
+        rise += (power * p.rJunction - rise) * k;
+        this->g = g;
+    }
+
+    float getSink()
+    {
+        return sink;
+    }
+
+    float getJunction()
+    {
+        return sink + rise;
+    }
+
+    // Constant power (W) that brings the junction to target in THERMAL_HORIZON seconds
+    float getAllowedPower(float target)
+    {
+        float e = exp(-THERMAL_HORIZON * g / p.capacity);
+        float allowed = (target - p.ambient * (1 - e) - sink * e) / ((1 - e) / g + p.rJunction);
+        return allowed > 0 ? allowed : 0;
+    }
+
+private:
+    ThermalParams p;
+    float sink = 0;   // Heatsink temperature (C)
+    float rise = 0;   // Junction over heatsink (K)
+    float g = 1;      // Heatsink conductance at the last update (W/K)
+    bool started = false;
+
+    float getConductance(uint16_t rpm)
+    {
+        return p.gStill + p.gPerKrpm * rpm / 1000;
+    }
+};
+#endif
@@ -0,0 +1,110 @@
+// Generated by tools/thermistor_table.cpp. Do not edit.
+//
+// Vishay NTCALUG03A103GC over 10000 ohms to ground, A = 0.001145241779, B = 0.0002314660102, C = 9.841582652e-08
+#include "ThermistorTable.hpp"
+
+const int16_t thermistorTable[THERM_TABLE_SIZE] PROGMEM = {
+    -27315,  -8429,  -7642,  -7158,  -6804,  -6522,  -6287,  -6085,  -5908,  -5749,
+     -5606,  -5474,  -5353,  -5241,  -5136,  -5037,  -4945,  -4857,  -4773,  -4694,
+     -4618,  -4545,  -4476,  -4409,  -4344,  -4282,  -4222,  -4164,  -4108,  -4054,
+     -4001,  -3949,  -3899,  -3851,  -3803,  -3757,  -3712,  -3668,  -3625,  -3583,
+     -3542,  -3501,  -3462,  -3423,  -3385,  -3348,  -3312,  -3276,  -3241,  -3206,
+     -3172,  -3138,  -3106,  -3073,  -3041,  -3010,  -2979,  -2948,  -2918,  -2889,
+     -2860,  -2831,  -2802,  -2774,  -2747,  -2719,  -2692,  -2666,  -2639,  -2613,
+     -2588,  -2562,  -2537,  -2512,  -2488,  -2463,  -2439,  -2415,  -2392,  -2368,
+     -2345,  -2323,  -2300,  -2277,  -2255,  -2233,  -2211,  -2190,  -2168,  -2147,
+     -2126,  -2105,  -2085,  -2064,  -2044,  -2024,  -2004,  -1984,  -1964,  -1945,
+     -1925,  -1906,  -1887,  -1868,  -1849,  -1831,  -1812,  -1794,  -1776,  -1757,
+     -1739,  -1721,  -1704,  -1686,  -1669,  -1651,  -1634,  -1617,  -1600,  -1583,
+     -1566,  -1549,  -1532,  -1516,  -1499,  -1483,  -1467,  -1450,  -1434,  -1418,
+     -1402,  -1387,  -1371,  -1355,  -1340,  -1324,  -1309,  -1293,  -1278,  -1263,
+     -1248,  -1233,  -1218,  -1203,  -1188,  -1174,  -1159,  -1145,  -1130,  -1116,
+     -1101,  -1087,  -1073,  -1058,  -1044,  -1030,  -1016,  -1002,   -989,   -975,
+      -961,   -947,   -934,   -920,   -907,   -893,   -880,   -866,   -853,   -840,
+      -827,   -814,   -800,   -787,   -774,   -761,   -749,   -736,   -723,   -710,
+      -697,   -685,   -672,   -660,   -647,   -635,   -622,   -610,   -597,   -585,
+      -573,   -561,   -548,   -536,   -524,   -512,   -500,   -488,   -476,   -464,
+      -452,   -440,   -428,   -417,   -405,   -393,   -382,   -370,   -358,   -347,
+      -335,   -324,   -312,   -301,   -289,   -278,   -266,   -255,   -244,   -233,
+      -221,   -210,   -199,   -188,   -177,   -166,   -155,   -143,   -132,   -121,
+      -111,   -100,    -89,    -78,    -67,    -56,    -45,    -35,    -24,    -13,
+        -2,      8,     19,     30,     40,     51,     61,     72,     82,     93,
+       103,    114,    124,    135,    145,    156,    166,    176,    187,    197,
+       207,    217,    228,    238,    248,    258,    268,    278,    289,    299,
+       309,    319,    329,    339,    349,    359,    369,    379,    389,    399,
+       409,    419,    428,    438,    448,    458,    468,    478,    487,    497,
+       507,    517,    526,    536,    546,    556,    565,    575,    584,    594,
+       604,    613,    623,    633,    642,    652,    661,    671,    680,    690,
+       699,    709,    718,    728,    737,    747,    756,    765,    775,    784,
+       794,    803,    812,    822,    831,    840,    850,    859,    868,    878,
+       887,    896,    905,    915,    924,    933,    942,    952,    961,    970,
+       979,    988,    997,   1007,   1016,   1025,   1034,   1043,   1052,   1061,
+      1071,   1080,   1089,   1098,   1107,   1116,   1125,   1134,   1143,   1152,
+      1161,   1170,   1179,   1188,   1197,   1206,   1215,   1224,   1233,   1242,
+      1251,   1260,   1269,   1278,   1287,   1296,   1305,   1314,   1323,   1332,
+      1341,   1350,   1359,   1367,   1376,   1385,   1394,   1403,   1412,   1421,
+      1430,   1439,   1447,   1456,   1465,   1474,   1483,   1492,   1501,   1509,
+      1518,   1527,   1536,   1545,   1554,   1562,   1571,   1580,   1589,   1598,
+      1607,   1615,   1624,   1633,   1642,   1651,   1659,   1668,   1677,   1686,
+      1694,   1703,   1712,   1721,   1730,   1738,   1747,   1756,   1765,   1774,
+      1782,   1791,   1800,   1809,   1817,   1826,   1835,   1844,   1852,   1861,
+      1870,   1879,   1888,   1896,   1905,   1914,   1923,   1931,   1940,   1949,
+      1958,   1966,   1975,   1984,   1993,   2001,   2010,   2019,   2028,   2037,
+      2045,   2054,   2063,   2072,   2080,   2089,   2098,   2107,   2116,   2124,
+      2133,   2142,   2151,   2159,   2168,   2177,   2186,   2195,   2203,   2212,
+      2221,   2230,   2239,   2247,   2256,   2265,   2274,   2283,   2292,   2300,
+      2309,   2318,   2327,   2336,   2345,   2353,   2362,   2371,   2380,   2389,
+      2398,   2407,   2415,   2424,   2433,   2442,   2451,   2460,   2469,   2478,
+      2487,   2496,   2504,   2513,   2522,   2531,   2540,   2549,   2558,   2567,
+      2576,   2585,   2594,   2603,   2612,   2621,   2630,   2639,   2648,   2657,
+      2666,   2675,   2684,   2693,   2702,   2711,   2720,   2729,   2738,   2747,
+      2756,   2765,   2774,   2784,   2793,   2802,   2811,   2820,   2829,   2838,
+      2847,   2857,   2866,   2875,   2884,   2893,   2902,   2912,   2921,   2930,
+      2939,   2948,   2958,   2967,   2976,   2985,   2995,   3004,   3013,   3023,
+      3032,   3041,   3051,   3060,   3069,   3079,   3088,   3097,   3107,   3116,
+      3126,   3135,   3144,   3154,   3163,   3173,   3182,   3192,   3201,   3211,
+      3220,   3230,   3239,   3249,   3258,   3268,   3277,   3287,   3297,   3306,
+      3316,   3326,   3335,   3345,   3355,   3364,   3374,   3384,   3393,   3403,
+      3413,   3423,   3432,   3442,   3452,   3462,   3472,   3481,   3491,   3501,
+      3511,   3521,   3531,   3541,   3551,   3561,   3571,   3581,   3591,   3601,
+      3611,   3621,   3631,   3641,   3651,   3661,   3671,   3681,   3691,   3702,
+      3712,   3722,   3732,   3742,   3753,   3763,   3773,   3784,   3794,   3804,
+      3815,   3825,   3835,   3846,   3856,   3867,   3877,   3888,   3898,   3909,
+      3919,   3930,   3940,   3951,   3962,   3972,   3983,   3994,   4004,   4015,
+      4026,   4037,   4047,   4058,   4069,   4080,   4091,   4102,   4112,   4123,
+      4134,   4145,   4156,   4167,   4178,   4190,   4201,   4212,   4223,   4234,
+      4245,   4256,   4268,   4279,   4290,   4302,   4313,   4324,   4336,   4347,
+      4359,   4370,   4382,   4393,   4405,   4416,   4428,   4439,   4451,   4463,
+      4475,   4486,   4498,   4510,   4522,   4534,   4545,   4557,   4569,   4581,
+      4593,   4605,   4617,   4630,   4642,   4654,   4666,   4678,   4691,   4703,
+      4715,   4728,   4740,   4753,   4765,   4777,   4790,   4803,   4815,   4828,
+      4841,   4853,   4866,   4879,   4892,   4905,   4917,   4930,   4943,   4956,
+      4970,   4983,   4996,   5009,   5022,   5035,   5049,   5062,   5076,   5089,
+      5102,   5116,   5130,   5143,   5157,   5171,   5184,   5198,   5212,   5226,
+      5240,   5254,   5268,   5282,   5296,   5310,   5324,   5339,   5353,   5367,
+      5382,   5396,   5411,   5425,   5440,   5455,   5469,   5484,   5499,   5514,
+      5529,   5544,   5559,   5574,   5590,   5605,   5620,   5636,   5651,   5667,
+      5682,   5698,   5713,   5729,   5745,   5761,   5777,   5793,   5809,   5825,
+      5841,   5858,   5874,   5891,   5907,   5924,   5940,   5957,   5974,   5991,
+      6008,   6025,   6042,   6059,   6077,   6094,   6112,   6129,   6147,   6164,
+      6182,   6200,   6218,   6236,   6254,   6273,   6291,   6310,   6328,   6347,
+      6365,   6384,   6403,   6422,   6441,   6461,   6480,   6499,   6519,   6539,
+      6559,   6578,   6598,   6619,   6639,   6659,   6680,   6700,   6721,   6742,
+      6763,   6784,   6805,   6827,   6848,   6870,   6891,   6913,   6935,   6958,
+      6980,   7002,   7025,   7048,   7071,   7094,   7117,   7141,   7164,   7188,
+      7212,   7236,   7260,   7285,   7309,   7334,   7359,   7384,   7409,   7435,
+      7461,   7487,   7513,   7539,   7566,   7592,   7619,   7647,   7674,   7702,
+      7730,   7758,   7786,   7815,   7844,   7873,   7902,   7932,   7962,   7992,
+      8022,   8053,   8084,   8116,   8147,   8179,   8212,   8244,   8277,   8310,
+      8344,   8378,   8412,   8447,   8482,   8517,   8553,   8589,   8626,   8663,
+      8700,   8738,   8777,   8815,   8855,   8894,   8935,   8975,   9017,   9058,
+      9101,   9144,   9187,   9231,   9276,   9321,   9367,   9414,   9461,   9509,
+      9557,   9607,   9657,   9708,   9760,   9812,   9866,   9920,   9975,  10032,
+     10089,  10147,  10206,  10267,  10328,  10391,  10455,  10520,  10587,  10654,
+     10724,  10795,  10867,  10941,  11016,  11094,  11173,  11254,  11337,  11423,
+     11510,  11600,  11693,  11788,  11885,  11986,  12090,  12197,  12307,  12421,
+     12539,  12661,  12788,  12919,  13056,  13198,  13347,  13501,  13663,  13833,
+     14011,  14198,  14395,  14604,  14826,  15061,  15312,  15582,  15872,  16186,
+     16528,  16902,  17315,  17776,  18296,  18890,  19580,  20401,  21408,  22695,
+     24452,  27138,  32410, -27315,
+};
@@ -20,32 +20,18 @@ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
 FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 OTHER DEALINGS IN THE SOFTWARE.
 */
-class Average
-{
-private:
-    int maxSamples;
-    float avg;
-    float sum;
-    int n;
+#ifndef __THERMISTOR_TABLE_HPP
+#define __THERMISTOR_TABLE_HPP
+#include "Hal.hpp"
 
-public:
-    Average(int maxSamples) : maxSamples(maxSamples), avg(0.0), sum(0.0), n(0.0)
-    {
-    }
+#define THERM_TABLE_SIZE 1024 // One entry per code of the 10 bit internal ADC
 
-    void update(float v)
-    {
-        sum += v;
-        if (++n >= maxSamples)
-        {
-            avg = sum / (float)n;
-            n = 0;
-            sum = 0.0;
-        }
-    }
+// Heatsink temperature in centidegrees for each ADC code of the thermistor
+// divider, in flash. Generated by tools/thermistor_table.cpp.
+extern const int16_t thermistorTable[THERM_TABLE_SIZE] PROGMEM;
 
-    float getAvg()
-    {
-        return avg;
-    }
-};
\ No newline at end of file
+inline int16_t thermistorTemp(uint16_t code)
+{
+    return hal::readFlashWord(&thermistorTable[code < THERM_TABLE_SIZE ? code : THERM_TABLE_SIZE - 1]);
+}
+#endif
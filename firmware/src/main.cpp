@@ -20,18 +20,21 @@ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
 FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 OTHER DEALINGS IN THE SOFTWARE.
 */
-#include <SPI.h>
-#include <MCP3202.h>
-#define USE_TIMER_3 true
-#include <TimerInterrupt.h>
-#include <ISR_Timer.h>
-#include <MCP_DAC.h>
-#include <RotaryEncoder.h>
+#include "Hal.hpp"
 #include "Display.hpp"
 #include "TempControl.hpp"
-#include "Average.hpp"
 #include "ControlKnob.hpp"
-#include "Calibration.hpp"
+#include "Channel.hpp"
+#include "Snapshot.hpp"
+#include "Scpi.hpp"
+#include "Telemetry.hpp"
+#include "Scheduler.hpp"
+#include "Profile.hpp"
+#include "Persist.hpp"
+#include "CalibrationSweep.hpp"
+#include "ThermalModel.hpp"
+#include "ThermistorTable.hpp"
+#include "Sequencer.hpp"
 
 // Voltage dial pins
 #define ROTARY_DT_1 11
@@ -44,140 +47,969 @@ OTHER DEALINGS IN THE SOFTWARE.
 #define ROTARY_SW_2 9
 
 // ADC/DAC pins
-#define DAC_CS 13 // DAC chip select
-#define ADC_CS 23 // ADC chip select
-
-// ADC constants
-#define ADC_VREF 4096      // ADC reference voltage in millivolts
-#define ADC_MAX_VALUE 4096 // Maximum value returned from ADC (2^bits)
-#define ADC_CURRENT 0      // Curremt channel
-#define ADC_VOLTAGE 1      // Voltage channel
-
-// DAC constants
-#define DAC_VOLTAGE 1 // Voltage channel
-#define DAC_CURRENT 0 // Current channel
-
-// Timer interrupt
-#define ADC_AVG_INT 1000                           // ADC averaging interval (ms)
-#define ADC_SAMPLE_INT 100                         // ADC sampling interval (ms)
-#define MAX_SAMPLES (ADC_AVG_INT / ADC_SAMPLE_INT) // Number of samples to collect
-
-// Conversion factors and functions (all values in millivolts and milliamps)
-#define MAX_MV 30000                                                  // Maximum millivolts the supply can output
-#define MAX_MA 2000                                                   // Maximum milliamps the supply can output
-#define ADC_TO_RAW_VOLT(x) ((x * ADC_VREF) / ADC_MAX_VALUE)           // Convert ADC reading to actual volts seen on pin
-#define ADC_TO_VOLT(x) (ADC_TO_RAW_VOLT(x) * (MAX_MV / ADC_VREF))     // Convert ADC reading to volts on supply output
-#define ADC_TO_AMP(x) (MAX_MA * (ADC_TO_RAW_VOLT(x) / ADC_MAX_VALUE)) // Convert ADC reading to amps through load
+#define DAC_CS 13   // DAC chip select
+#define ADC_CS 23   // ADC chip select
+#define DAC_LDAC 19 // DAC latch (A1). Needs LDAC lifted off ground; use HAL_NO_PIN on a board without that.
+
+// Second output board (NUM_CHANNELS 2). Its LDAC is wired to DAC_LDAC as
+// well, so both boards' DACs change on the same pulse.
+#define DAC2_CS 21 // DAC chip select (A3)
+#define ADC2_CS 20 // ADC chip select (A2)
+
+// Sampling
+#define SAMPLE_RATE 2000  // Base sampling rate (Hz)
+#define CHANNEL_RATE (SAMPLE_RATE / NUM_CHANNELS) // Each output is sampled in turn
+#define LIST_TICK_US (1000000 / SAMPLE_RATE) // Time resolution of a list
+#define THERM_DIVIDER 200 // Thermistor is sampled every THERM_DIVIDER ticks
+
+// Filtering
+#define TEMP_FILTER_K 3   // Thermistor filter time constant is 2^k readings
+
+// Task periods (microseconds)
+#define MEASURE_PERIOD 2000   // The sample queue holds 16 ms of voltage and current samples
+#define PROTECT_PERIOD 10000
+#define CONTROL_PERIOD 2000   // Dials, remote commands and DAC
+#define FAN_PERIOD 100000
+#define DISPLAY_PERIOD 5000   // The display pushes DISPLAY_FLUSH_BYTES per run
+#define PERSIST_PERIOD 4000   // An EEPROM byte write takes 3.3 ms
+#define THERMAL_PERIOD 100000
+#define NUM_TASKS 7
+
+// Energy page
+#define ENERGY_REFRESH 40 // Display task runs between updates of the page
+#define TICKS_PER_HOUR (CHANNEL_RATE * 3600LL)
+
+// Diagnostics page (only with -DPROFILE)
+#define DIAG_REFRESH 40 // Display task runs between updates of the page
+
+// Setpoint trim
+#define TRIM_CC_MARGIN 10 // Output counts as current limited within this many mA of the current setpoint
+
+// Calibration sweeps (see CalibrationSweep.hpp)
+#define CAL_VOLT_TOLERANCE 7 // Halves of an average may differ by one ADC code (mV)
+#define CAL_AMP_TOLERANCE 1  // Halves of an average may differ by two ADC codes (mA)
+#define CAL_SHORT_MV 5000    // Voltage setpoint for the current sweep, driving a short through the reference meter
 
 // Rotary encoder constants
 #define MV_PER_CLICK 10
 #define MA_PER_CLICK 10
+#define MV_PER_COARSE_CLICK 1000
+#define MA_PER_COARSE_CLICK 100
 
 // Fan control constants
 #define FAN_PWM_PIN 8          // Fan PWM control pin
 #define FAN_SENSOR_PIN 0       // Fan tacho pin
-#define THERM_PIN A0           // Thermistor sense pin
-#define R_THERM_GROUND 10000.0 // Voltage divider resistance to ground
+#define THERM_PIN A0           // Thermistor sense pin. The divider and thermistor are in tools/thermistor_table.cpp.
 #define FAN_ON 30.0            // Temp where fan is turned on
 #define FAN_MAX 35.0           // Temp where fan is maxed out
 
-// Steinhart-Hart coefficients for Vishay NTCALUG03A103GC
-#define THERM_R25 10000.0
-#define THERM_COEFF_A 1.145241779e-3
-#define THERM_COEFF_B 2.314660102e-4
-#define THERM_COEFF_C 0.9841582652e-7
-
 // Overtemp protection
 #define OVERTEMP_LIMIT_ON 90  // Overtemp protection turns on
 #define OVERTEMP_LIMIT_OFF 80 // Overtemp protection turns off
 
+// Thermal model of the TIP142 and its heatsink (see ThermalModel.hpp). Fit the
+// heatsink parameters to a heat-soak run with tools/thermal_fit.cpp.
+#define RECTIFIED_MV 38000        // Unregulated supply to the pass transistor (mV)
+#define THERMAL_CAPACITY 250.0    // J/K
+#define THERMAL_G_STILL 0.8       // W/K
+#define THERMAL_G_PER_KRPM 0.6    // W/K per 1000 RPM
+#define THERMAL_R_JUNCTION 1.5    // K/W: 1.0 junction to case, 0.5 for the insulating pad
+#define THERMAL_TAU_JUNCTION 2.0  // s
+#define THERMAL_AMBIENT 25.0      // C
+#define TJ_TARGET 125.0           // Junction temperature the derating holds the output under (C)
+#define TJ_TRIP 150.0             // Estimated junction temperature that shuts the output down (C)
+#define DERATE_HYSTERESIS 5       // Change in the derated current (mA) before the DAC is rewritten
+
 // Settings lock
 #define LOCK_PIN 1 // Settings lock
 
 // Display
 Display display;
 
-// Rotary encoders
-RotaryEncoder currentEncoder(ROTARY_DT_2, ROTARY_CLK_2, RotaryEncoder::LatchMode::TWO03);
-RotaryEncoder voltageEncoder(ROTARY_DT_1, ROTARY_CLK_1, RotaryEncoder::LatchMode::TWO03);
-ControlKnob currentDial(currentEncoder, display, Display::ID::current, 0, MAX_MA, 10, 100, ROTARY_SW_2);
-ControlKnob voltageDial(voltageEncoder, display, Display::ID::voltage, 0, MAX_MV, 10, 1000, ROTARY_SW_1);
+// Tasks run from loop()
+Scheduler<NUM_TASKS> scheduler;
+
+// Rotary encoders, decoded in the sampling interrupt
+QuadraturePins<ROTARY_DT_2, ROTARY_CLK_2, ROTARY_SW_2> currentEncoder;
+QuadraturePins<ROTARY_DT_1, ROTARY_CLK_1, ROTARY_SW_1> voltageEncoder;
+ControlKnob currentDial(currentEncoder, display, Display::ID::current, 0, MAX_MA, MA_PER_CLICK, MA_PER_COARSE_CLICK);
+ControlKnob voltageDial(voltageEncoder, display, Display::ID::voltage, 0, MAX_MV, MV_PER_CLICK, MV_PER_COARSE_CLICK);
 
-// ADC
-MCP3202 adc(ADC_CS);
+// Fine mode acceleration (see KnobAcceleration). Turns slower than 25 detents/s
+// keep the normal increment. Spinning the voltage dial at 50 detents/s covers
+// the 3000 detent range in 2 s.
+#define ACCEL_STEPS(a) (sizeof(a) / sizeof(a[0]))
+const KnobAcceleration voltageAcceleration[] = {
+    {15, 50}, // Over ~66 detents/s
+    {25, 30}, // Over 40 detents/s
+    {40, 5},  // Over 25 detents/s
+};
+const KnobAcceleration currentAcceleration[] = {
+    {25, 5}, // Over 40 detents/s
+    {40, 2}, // Over 25 detents/s
+};
+
+// Output boards
+static_assert(NUM_CHANNELS <= 2, "Pins are only assigned for two output boards");
+hal::Adc adc(ADC_CS);
+hal::Dac dac;
+#if NUM_CHANNELS > 1
+hal::Adc adc2(ADC2_CS);
+hal::Dac dac2;
+hal::Adc *const adcs[NUM_CHANNELS] = {&adc, &adc2};
+Channel channels[NUM_CHANNELS] = {{adc, dac}, {adc2, dac2}};
+#else
+hal::Adc *const adcs[NUM_CHANNELS] = {&adc};
+Channel channels[NUM_CHANNELS] = {{adc, dac}};
+#endif
+Sampler sampler(adcs, THERM_PIN);
+bool writeDac = false; // Setpoints or trim changed since the DACs were last written
+
+// How the outputs after the first follow it (OUTPut:TRACk). In series the
+// first output's voltage setpoint is the total across all of them, shared
+// out evenly; in mirror they all put out the same. Either way they take the
+// first output's current limit and output enable, and trip together.
+enum Tracking
+{
+  trackOff,
+  trackSeries,
+  trackMirror
+};
+Tracking tracking = trackOff;
 
-// DAC
-MCP4922 dac;
+// Output the dials, the display and remote commands act on (INSTrument:NSELect).
+// Always the first while tracking.
+uint8_t selected = 0;
 
 // Fan
 TempControl tempControl(FAN_PWM_PIN, FAN_SENSOR_PIN, FAN_ON, FAN_MAX);
 
-// Averaged readings
-Average measVolt(MAX_SAMPLES);
-Average measAmp(MAX_SAMPLES);
-Average measTemp(MAX_SAMPLES);
+// Filtered temperature, in centidegrees
+ExpFilter measTemp(TEMP_FILTER_K);
 
-// Voltage and current set on dials (millivolts and milliamps)
-uint32_t vSet = 0.0;
-uint32_t iSet = 0.0;
+// Latest filtered readings (oversampled codes of each output, degrees C)
+struct Readings
+{
+  int32_t volt[NUM_CHANNELS];
+  int32_t amp[NUM_CHANNELS];
+  float temp;
+};
+Snapshot<Readings> readings;
 
 // Overtemp protection
 bool overTemp = false;
 
+// Fan told to run but no tach pulses (see TempControl::isStalled())
+bool fanStalled = false;
+
+// Thermal model and the current it allows (mA)
+const ThermalParams thermalParams = {THERMAL_CAPACITY, THERMAL_G_STILL, THERMAL_G_PER_KRPM,
+                                     THERMAL_R_JUNCTION, THERMAL_TAU_JUNCTION, THERMAL_AMBIENT};
+ThermalModel thermal(thermalParams);
+uint32_t iDerated = MAX_MA;
+
+// OVP and OCP trips on the display
+uint8_t shownFault = 0;
+
 // Settings lock
 bool locked = false;
 
-float getTemp()
+// Output enable changed remotely
+bool outputChanged = false;
+
+// Settings kept across power cycles
+Persist persist;
+
+// Calibration of each output, as stored in EEPROM (filled in by setup())
+PersistRegion calRegions[NUM_CHANNELS];
+
+// Calibration. The sweeps wait for a reference reading at these grid points.
+CalibrationSweep calSweep(persist, calRegions, NUM_CHANNELS);
+uint8_t calChannel = 0; // Output being swept
+const uint8_t voltageRefs[] = {1, 15, 29};    // 1 V, 15 V and 29 V
+const uint8_t currentRefs[] = {1, 5, 10, 19}; // 0.1 A, 0.5 A, 1.0 A and 1.9 A
+
+// List mode, stepped from the sampling interrupt
+Sequencer sequencer;
+uint8_t listChannel = 0; // Output the list drives, set by its first point
+
+// Remote control. Telemetry streams the first output.
+Scpi scpi;
+Telemetry telemetry(1000000 / CHANNEL_RATE);
+uint16_t lastAmpCode = 0;
+
+// The output whose settings channel c takes: the first while tracking, otherwise its own
+uint8_t leaderOf(uint8_t c)
 {
-  int v = analogRead(THERM_PIN);
-  float r2 = (R_THERM_GROUND * (1023.0 / (float)v - 1.0));
-  float logR2 = log(r2);
-  return (1.0 / (THERM_COEFF_A + THERM_COEFF_B * logR2 + THERM_COEFF_C * logR2 * logR2 * logR2)) - 273.15;
+  return tracking == trackOff ? c : 0;
 }
 
-void onReadADC()
+// Voltage channel c is set to (mV)
+uint32_t targetVolt(uint8_t c)
 {
-  SPI.beginTransaction(SPISettings(500000, MSBFIRST, SPI_MODE0));
-  measVolt.update(ADC_TO_VOLT((float)adc.readChannel(ADC_VOLTAGE)));
-  measAmp.update(ADC_TO_AMP((float)adc.readChannel(ADC_CURRENT)));
-  measTemp.update(getTemp());
+  uint32_t v = channels[leaderOf(c)].vSet;
+  if (tracking == trackSeries)
+  {
+    // The first output takes the odd millivolts
+    uint32_t share = v / NUM_CHANNELS;
+    return c == 0 ? v - share * (NUM_CHANNELS - 1) : share;
+  }
+  return v;
 }
 
-void setup()
+// Current limit channel c is set to, before derating (mA)
+uint32_t targetAmp(uint8_t c)
 {
-  pinMode(DAC_CS, OUTPUT);
-  pinMode(ADC_CS, OUTPUT);
-  pinMode(FAN_SENSOR_PIN, INPUT_PULLUP);
-  pinMode(FAN_PWM_PIN, OUTPUT);
-  pinMode(LOCK_PIN, INPUT_PULLUP);
-  digitalWrite(DAC_CS, HIGH);
-  digitalWrite(ADC_CS, HIGH);
-  Serial.begin(115200);
-  SPI.begin();
+  return channels[leaderOf(c)].iSet;
+}
 
-  // Connect current and voltage dial so coarse mode behaves nicely
-  currentDial.setPeer(&voltageDial);
-  voltageDial.setPeer(&currentDial);
+bool isOutputOn(uint8_t c)
+{
+  return channels[leaderOf(c)].outputOn;
+}
 
-  // Start timer interrupt
-  ITimer3.init();
-  ITimer3.attachInterruptInterval(ADC_SAMPLE_INT, onReadADC);
+// Highest voltage setpoint of the selected output. In series, the dial sets the total.
+uint32_t maxVolt()
+{
+  return tracking == trackSeries ? (uint32_t)MAX_MV * NUM_CHANNELS : MAX_MV;
+}
 
-  // Set all DAC output voltages to zero
-  dac.begin(DAC_CS);
-  dac.analogWrite(0, DAC_CURRENT);
-  dac.analogWrite(0, DAC_VOLTAGE);
-  display.init();
+// PROTECT_OVP and/or PROTECT_OCP while channel c is held at zero by a trip.
+// Tracking outputs trip together, so any of them holds all.
+uint8_t getFault(uint8_t c)
+{
+  if (tracking == trackOff)
+  {
+    return channels[c].protection.getFault();
+  }
+  uint8_t fault = 0;
+  for (uint8_t i = 0; i < NUM_CHANNELS; i++)
+  {
+    fault |= channels[i].protection.getFault();
+  }
+  return fault;
+}
 
-  // Initialize cooling system
-  tempControl.begin();
+// True while a calibration sweep or a list drives channel c instead of its setpoints
+bool isTakenOver(uint8_t c)
+{
+  return (calSweep.isRunning() && c == calChannel) || (sequencer.isActive() && c == listChannel);
 }
 
-void loop()
+void onSample()
+{
+  PROFILE_SCOPE(profileSampler);
+
+  // First, so list points start with as little jitter as possible
+  uint16_t listVolt, listAmp;
+  if (sequencer.tick(listVolt, listAmp))
+  {
+    channels[listChannel].load(listVolt, listAmp);
+    channels[listChannel].dac.latch();
+  }
+  voltageEncoder.service();
+  currentEncoder.service();
+  sampler.onTimer();
+
+  // Only the output sampled on this tick has new codes
+  uint8_t c = sampler.getSampled();
+  Channel &ch = channels[c];
+  if (ch.onSample(sampler.getLast(SAMPLE_INPUT(c, ADC_VOLTAGE)), sampler.getLast(SAMPLE_INPUT(c, ADC_CURRENT))))
+  {
+    if (c == listChannel)
+    {
+      sequencer.abort();
+    }
+    for (uint8_t i = 0; i < NUM_CHANNELS; i++)
+    {
+      if (i == c || tracking != trackOff)
+      {
+        channels[i].load(0, 0);
+        channels[i].dac.latch();
+      }
+    }
+    PROFILE_ADD(profileTrip, hal::micros() - ch.protection.getOverSince());
+  }
+}
+
+// Loads both DAC channels of output c, or zeros while it is held by a trip.
+// Call with interrupts off, so a trip can't come in the middle and then be
+// overwritten, and latch before turning them back on.
+void loadOutputs(uint8_t c, uint16_t volt, uint16_t amp)
+{
+  Channel &ch = channels[c];
+  if (getFault(c))
+  {
+    volt = 0;
+    amp = 0;
+  }
+  ch.load(volt, amp);
+  ch.dacVolt = volt;
+  ch.dacAmp = amp;
+}
+
+// Writes both DAC channels of output c, which change together on the latch
+void writeOutputs(uint8_t c, uint16_t volt, uint16_t amp)
+{
+  uint8_t state = hal::disableInterrupts();
+  loadOutputs(c, volt, amp);
+  channels[c].dac.latch();
+  hal::restoreInterrupts(state);
+}
+
+// Converts the limits of every output to ADC codes. Call after they or the calibration change.
+void updateProtection()
+{
+  for (uint8_t c = 0; c < NUM_CHANNELS; c++)
+  {
+    channels[c].updateProtection();
+  }
+}
+
+void sendTelemetry()
+{
+  Calibration &cal = channels[0].cal;
+  int32_t volt = cal.toVReading(ADC_TO_VOLT((int32_t)telemetry.getRawVolt()));
+  int32_t amp = cal.toIReading(ADC_TO_AMP((int32_t)telemetry.getRawAmp()));
+  telemetry.send(volt, amp, measTemp.get(), tempControl.getCachedSpeed());
+}
+
+// Drains the sample queue, decimating voltage and current and filtering
+// everything. Runs in loop() context.
+void consumeSamples()
+{
+  uint8_t channel;
+  uint16_t code;
+  bool updated = false;
+  while (sampler.next(channel, code))
+  {
+    updated = true;
+    if (channel == SAMPLE_THERM)
+    {
+      measTemp.update(thermistorTemp(code));
+      continue;
+    }
+    uint8_t c = SAMPLE_OUTPUT(channel);
+    uint8_t input = channel & 1;
+    Channel &ch = channels[c];
+
+    // Current is sampled just before voltage on every tick, so a voltage sample completes a pair
+    if (c == 0 && input == ADC_CURRENT)
+    {
+      lastAmpCode = code;
+    }
+    if (c == 0 && input == ADC_VOLTAGE && telemetry.addSample(code, lastAmpCode))
+    {
+      sendTelemetry();
+    }
+
+    if (input == ADC_VOLTAGE && ch.voltDecimator.update(code))
+    {
+      ch.measVolt.update(ch.voltDecimator.get());
+
+      // The trim works on the decimated readings rather than the filtered ones, so it isn't slowed down by the window
+      int32_t raw = ADC_TO_VOLT((int32_t)ch.voltDecimator.get()) >> OVERSAMPLE_BITS;
+      int32_t volt = ch.cal.toVReading(raw);
+      uint32_t target = targetVolt(c);
+      bool hold = !isOutputOn(c) || locked || overTemp || target == 0 ||
+                  ch.calAmpNow + TRIM_CC_MARGIN >= (int32_t)min(targetAmp(c), iDerated) || isTakenOver(c) || getFault(c);
+      writeDac |= ch.trim.update(target, volt, hold);
+      if (c == calChannel)
+      {
+        calSweep.addReading(calVReading, raw);
+      }
+    }
+    else if (input == ADC_CURRENT && ch.ampDecimator.update(code))
+    {
+      ch.measAmp.update(ch.ampDecimator.get());
+      int32_t raw = ADC_TO_AMP((int32_t)ch.ampDecimator.get()) >> OVERSAMPLE_BITS;
+      ch.calAmpNow = ch.cal.toIReading(raw);
+      if (c == calChannel)
+      {
+        calSweep.addReading(calIReading, raw);
+      }
+    }
+  }
+  if (updated)
+  {
+    Readings r;
+    for (uint8_t c = 0; c < NUM_CHANNELS; c++)
+    {
+      r.volt[c] = ADC_TO_VOLT((int32_t)channels[c].measVolt.get()) >> OVERSAMPLE_BITS;
+      r.amp[c] = ADC_TO_AMP((int32_t)channels[c].measAmp.get()) >> OVERSAMPLE_BITS;
+    }
+    r.temp = measTemp.get() / 100.0;
+    readings.write(r);
+  }
+}
+
+// Calibrated voltage of the selected output, or the total across the outputs in series (mV)
+int32_t measuredVolt(const Readings &r)
+{
+  if (tracking != trackSeries)
+  {
+    return channels[selected].cal.toVReading(r.volt[selected]);
+  }
+  int32_t volt = 0;
+  for (uint8_t c = 0; c < NUM_CHANNELS; c++)
+  {
+    volt += channels[c].cal.toVReading(r.volt[c]);
+  }
+  return volt;
+}
+
+// Calibrated current of the selected output (mA)
+int32_t measuredAmp(const Readings &r)
+{
+  return channels[selected].cal.toIReading(r.amp[selected]);
+}
+
+// Power delivered by the selected output, or by all of them while tracking (mW)
+int32_t measuredPower(const Readings &r)
+{
+  int32_t power = 0;
+  for (uint8_t c = 0; c < NUM_CHANNELS; c++)
+  {
+    if (c == selected || tracking != trackOff)
+    {
+      power += channels[c].cal.toIReading(r.amp[c]) * channels[c].cal.toVReading(r.volt[c]) / 1000;
+    }
+  }
+  return power;
+}
+
+// Clears OVP and OCP trips and puts the setpoints back on the DACs
+void clearTrip()
+{
+  for (uint8_t c = 0; c < NUM_CHANNELS; c++)
+  {
+    Channel &ch = channels[c];
+    if (ch.protection.getFault())
+    {
+      ch.protection.clear();
+      ch.trim.setpointChanged();
+      writeDac = true;
+    }
+  }
+}
+
+// Makes output c the one the dials, the display and remote commands act on
+void select(uint8_t c)
+{
+  selected = c;
+  voltageDial.setMaxValue(maxVolt());
+  voltageDial.setValue(channels[c].vSet);
+  currentDial.setValue(channels[c].iSet);
+  display.setChannel(c, tracking == trackSeries ? F("SER") : (tracking == trackMirror ? F("MIR") : nullptr));
+}
+
+// Switches tracking on or off. Every output keeps what it puts out as its own
+// setpoints, and on tracking the others then take the first output's, so in
+// series the total is the first output's voltage times the number of outputs.
+void setTracking(Tracking mode)
+{
+  uint32_t volt[NUM_CHANNELS], amp[NUM_CHANNELS];
+  bool on[NUM_CHANNELS];
+  for (uint8_t c = 0; c < NUM_CHANNELS; c++)
+  {
+    volt[c] = targetVolt(c);
+    amp[c] = targetAmp(c);
+    on[c] = isOutputOn(c);
+  }
+  for (uint8_t c = 0; c < NUM_CHANNELS; c++)
+  {
+    channels[c].vSet = volt[c];
+    channels[c].iSet = amp[c];
+    channels[c].outputOn = on[c];
+    channels[c].trim.setpointChanged();
+  }
+  tracking = mode;
+  if (mode == trackSeries)
+  {
+    channels[0].vSet *= NUM_CHANNELS;
+  }
+  select(0);
+  writeDac = true;
+}
+
+// Formats thousandths as a decimal number with three places, returning the length
+int formatMilli(char *buf, size_t size, int64_t v)
+{
+  int32_t whole = v / 1000;
+  int16_t frac = v % 1000;
+  return snprintf_P(buf, size, v < 0 && whole == 0 ? PSTR("-%ld.%03d") : PSTR("%ld.%03d"), (long)whole, abs(frac));
+}
+
+void handleScpi(ScpiRequest &req, Readings &r)
+{
+  switch (req.type)
+  {
+  case ScpiRequest::setVoltage:
+  case ScpiRequest::setCurrent:
+  {
+    // Same path as turning the dials, so the lock switch applies
+    if (locked || overTemp || calSweep.isRunning())
+    {
+      scpi.error(SCPI_SETTINGS_CONFLICT);
+      return;
+    }
+    ControlKnob &dial = req.type == ScpiRequest::setVoltage ? voltageDial : currentDial;
+    if (!dial.setValue(req.value))
+    {
+      scpi.error(SCPI_DATA_OUT_OF_RANGE);
+    }
+    break;
+  }
+  case ScpiRequest::getVoltage:
+    scpi.replyMilli(channels[selected].vSet);
+    break;
+  case ScpiRequest::getCurrent:
+    scpi.replyMilli(channels[selected].iSet);
+    break;
+  case ScpiRequest::measVoltage:
+    scpi.replyMilli(measuredVolt(r));
+    break;
+  case ScpiRequest::measCurrent:
+    scpi.replyMilli(measuredAmp(r));
+    break;
+  case ScpiRequest::measTemperature:
+  {
+    // Heatsink as measured, then the junction as estimated by the thermal model
+    char buf[24];
+    int16_t sink = r.temp * 10, junction = thermal.getJunction() * 10;
+    snprintf_P(buf, sizeof(buf), PSTR("%d.%d,%d.%d"), sink / 10, abs(sink % 10), junction / 10, abs(junction % 10));
+    scpi.reply(buf);
+    break;
+  }
+  case ScpiRequest::measFan:
+  {
+    char buf[16];
+    snprintf_P(buf, sizeof(buf), fanStalled ? PSTR("%u,STALL") : PSTR("%u,OK"), tempControl.getCachedSpeed());
+    scpi.reply(buf);
+    break;
+  }
+  case ScpiRequest::setOutput:
+  {
+    if (locked || overTemp || calSweep.isRunning())
+    {
+      scpi.error(SCPI_SETTINGS_CONFLICT);
+      return;
+    }
+    Channel &ch = channels[selected];
+    outputChanged = ch.outputOn != (req.value != 0);
+    ch.outputOn = req.value != 0;
+    if (!ch.outputOn && selected == listChannel)
+    {
+      sequencer.abort();
+    }
+    break;
+  }
+  case ScpiRequest::getOutput:
+    scpi.replyBool(channels[selected].outputOn);
+    break;
+  case ScpiRequest::setTelemetry:
+    telemetry.setEnabled(req.value != 0);
+    break;
+  case ScpiRequest::getTelemetry:
+    scpi.replyBool(telemetry.isEnabled());
+    break;
+  case ScpiRequest::setTrim:
+    // While tracking, the trim and the limits are set on every output
+    for (uint8_t c = 0; c < NUM_CHANNELS; c++)
+    {
+      if (c == selected || tracking != trackOff)
+      {
+        channels[c].trim.setEnabled(req.value != 0);
+      }
+    }
+    writeDac = true;
+    break;
+  case ScpiRequest::getTrim:
+    scpi.replyBool(channels[selected].trim.isEnabled());
+    break;
+  case ScpiRequest::setOvp:
+  case ScpiRequest::setOcp:
+  {
+    // In series the voltage limit is on the total, and each output checks its share like targetVolt()
+    bool ovp = req.type == ScpiRequest::setOvp;
+    bool series = ovp && tracking == trackSeries;
+    if (req.value <= 0 || req.value > (ovp ? (series ? (int32_t)OVP_MAX * NUM_CHANNELS : OVP_MAX) : OCP_MAX))
+    {
+      scpi.error(SCPI_DATA_OUT_OF_RANGE);
+      return;
+    }
+    int32_t share = series ? req.value / NUM_CHANNELS : req.value;
+    for (uint8_t c = 0; c < NUM_CHANNELS; c++)
+    {
+      if (c == selected || tracking != trackOff)
+      {
+        (ovp ? channels[c].ovpLimit : channels[c].ocpLimit) = series && c == 0 ? req.value - share * (NUM_CHANNELS - 1) : share;
+        channels[c].updateProtection();
+      }
+    }
+    break;
+  }
+  case ScpiRequest::getOvp:
+  {
+    int32_t limit = channels[selected].ovpLimit;
+    for (uint8_t c = 1; c < NUM_CHANNELS && tracking == trackSeries; c++)
+    {
+      limit += channels[c].ovpLimit;
+    }
+    scpi.replyMilli(limit);
+    break;
+  }
+  case ScpiRequest::getOcp:
+    scpi.replyMilli(channels[selected].ocpLimit);
+    break;
+  case ScpiRequest::clearProtection:
+    clearTrip();
+    break;
+  case ScpiRequest::getTripped:
+  {
+    uint8_t fault = getFault(selected);
+    scpi.reply(fault & PROTECT_OVP ? F("OVP") : (fault & PROTECT_OCP ? F("OCP") : F("NONE")));
+    break;
+  }
+  case ScpiRequest::startCalVoltage:
+  case ScpiRequest::startCalCurrent:
+    // The sweep drives the selected output on its own, so it needs it on, unlocked and not tracked
+    if (locked || overTemp || !channels[selected].outputOn || tracking != trackOff || calSweep.isRunning() ||
+        sequencer.isActive())
+    {
+      scpi.error(SCPI_SETTINGS_CONFLICT);
+      return;
+    }
+
+    // The list is in DAC codes from the calibration that is about to change, and the meter must not
+    // read the tables while they are rebuilt
+    if (listChannel == selected)
+    {
+      sequencer.clear();
+    }
+    calChannel = selected;
+    channels[calChannel].meter.setOn(false);
+    if (req.type == ScpiRequest::startCalVoltage)
+    {
+      calSweep.start(channels[calChannel].cal, calVOutput, calVReading, voltageRefs, sizeof(voltageRefs), CAL_VOLT_TOLERANCE);
+    }
+    else
+    {
+      calSweep.start(channels[calChannel].cal, calIOutput, calIReading, currentRefs, sizeof(currentRefs), CAL_AMP_TOLERANCE);
+    }
+    break;
+  case ScpiRequest::setCalReference:
+    if (!calSweep.setReference(req.value))
+    {
+      scpi.error(SCPI_SETTINGS_CONFLICT);
+    }
+    break;
+  case ScpiRequest::abortCal:
+    calSweep.abort();
+    break;
+  case ScpiRequest::getCalState:
+  {
+    static const char states[][10] PROGMEM = {"IDLE", "SETTLING", "REFERENCE", "DONE", "FAILED"};
+    char buf[32];
+    strcpy_P(buf, states[calSweep.getState()]);
+    uint8_t n = strlen(buf);
+    snprintf_P(buf + n, sizeof(buf) - n, PSTR(",%u,%u"), calSweep.getPoint(), calSweep.getPoints());
+    scpi.reply(buf);
+    break;
+  }
+  case ScpiRequest::listClear:
+    sequencer.clear();
+    break;
+  case ScpiRequest::listPoint:
+  case ScpiRequest::listRamp:
+    if (req.value > MAX_MV || req.current > MAX_MA)
+    {
+      scpi.error(SCPI_DATA_OUT_OF_RANGE);
+    }
+    else if (sequencer.isActive() || (sequencer.getPoints() && listChannel != selected))
+    {
+      // A list is in the DAC codes of one output
+      scpi.error(SCPI_SETTINGS_CONFLICT);
+    }
+    else
+    {
+      listChannel = selected;
+      Channel &ch = channels[listChannel];
+      if (!sequencer.add(ch.toVoltCode(req.value), ch.toAmpCode(req.current), (req.dwell + LIST_TICK_US / 2) / LIST_TICK_US,
+                         req.type == ScpiRequest::listRamp))
+      {
+        scpi.error(SCPI_TOO_MUCH_DATA);
+      }
+    }
+    break;
+  case ScpiRequest::setListCount:
+    if (req.value > 0xffff)
+    {
+      scpi.error(SCPI_DATA_OUT_OF_RANGE);
+    }
+    else if (sequencer.isActive())
+    {
+      scpi.error(SCPI_SETTINGS_CONFLICT);
+    }
+    else
+    {
+      sequencer.setRepeat(req.value);
+    }
+    break;
+  case ScpiRequest::getListCount:
+  case ScpiRequest::getListPoints:
+  {
+    char buf[8];
+    snprintf_P(buf, sizeof(buf), PSTR("%u"), req.type == ScpiRequest::getListCount ? sequencer.getRepeat() : sequencer.getPoints());
+    scpi.reply(buf);
+    break;
+  }
+  case ScpiRequest::listArm:
+  case ScpiRequest::listStart:
+    // The list drives its output past the dials, but not past anything that holds it at zero, nor
+    // apart from outputs tracking it
+    if (overTemp || !isOutputOn(listChannel) || calSweep.isRunning() || getFault(listChannel) || sequencer.isActive() ||
+        tracking != trackOff)
+    {
+      scpi.error(SCPI_SETTINGS_CONFLICT);
+      return;
+    }
+    sequencer.setAmpLimit(channels[listChannel].toAmpCode(iDerated));
+    if (!sequencer.arm(req.type == ScpiRequest::listStart, channels[listChannel].dacVolt, channels[listChannel].dacAmp))
+    {
+      scpi.error(SCPI_SETTINGS_CONFLICT);
+    }
+    break;
+  case ScpiRequest::listTrigger:
+    if (!sequencer.trigger())
+    {
+      scpi.error(SCPI_TRIGGER_IGNORED);
+    }
+    break;
+  case ScpiRequest::listAbort:
+    sequencer.abort();
+    break;
+  case ScpiRequest::getMeter:
+  {
+    EnergyTotals t;
+    channels[selected].meter.read(t);
+    char buf[48];
+    char *p = buf;
+    p += formatMilli(p, buf + sizeof(buf) - p, t.charge * 1000 / TICKS_PER_HOUR);
+    *p++ = ',';
+    p += formatMilli(p, buf + sizeof(buf) - p, t.energy / TICKS_PER_HOUR);
+    *p++ = ',';
+    formatMilli(p, buf + sizeof(buf) - p, t.ticks * 1000 / CHANNEL_RATE);
+    scpi.reply(buf);
+    break;
+  }
+  case ScpiRequest::resetMeter:
+    channels[selected].meter.reset();
+    break;
+  case ScpiRequest::setMeterHold:
+    channels[selected].meter.setHeld(req.value);
+    break;
+  case ScpiRequest::getMeterHold:
+    scpi.replyBool(channels[selected].meter.isHeld());
+    break;
+  case ScpiRequest::setMeterDisplay:
+    if (overTemp || calSweep.isRunning() || getFault(selected))
+    {
+      scpi.error(SCPI_SETTINGS_CONFLICT);
+    }
+    else if (req.value)
+    {
+      display.energy();
+    }
+    else if (display.isEnergy())
+    {
+      display.normal();
+    }
+    break;
+  case ScpiRequest::getListState:
+  {
+    static const char states[][8] PROGMEM = {"IDLE", "ARMED", "RUNNING", "DONE", "ABORTED"};
+    char buf[32];
+    strcpy_P(buf, states[sequencer.getState()]);
+    uint8_t n = strlen(buf);
+    snprintf_P(buf + n, sizeof(buf) - n, PSTR(",%u,%u"), sequencer.getPoint() + 1, sequencer.getPass());
+    scpi.reply(buf);
+    break;
+  }
+  case ScpiRequest::selectChannel:
+    if (req.value < 1 || req.value > NUM_CHANNELS)
+    {
+      scpi.error(SCPI_DATA_OUT_OF_RANGE);
+    }
+    else if (tracking != trackOff && req.value != 1)
+    {
+      // The others follow the first
+      scpi.error(SCPI_SETTINGS_CONFLICT);
+    }
+    else
+    {
+      select(req.value - 1);
+    }
+    break;
+  case ScpiRequest::getChannel:
+  {
+    char buf[4];
+    snprintf_P(buf, sizeof(buf), PSTR("%u"), selected + 1);
+    scpi.reply(buf);
+    break;
+  }
+  case ScpiRequest::setTracking:
+    if (NUM_CHANNELS == 1 && req.value != SCPI_TRACK_OFF)
+    {
+      scpi.error(SCPI_SETTINGS_CONFLICT);
+    }
+    else if (locked || overTemp || calSweep.isRunning() || sequencer.isActive())
+    {
+      scpi.error(SCPI_SETTINGS_CONFLICT);
+    }
+    else
+    {
+      setTracking(req.value == SCPI_TRACK_SERIES ? trackSeries : (req.value == SCPI_TRACK_MIRROR ? trackMirror : trackOff));
+    }
+    break;
+  case ScpiRequest::getTracking:
+    scpi.reply(tracking == trackSeries ? F("SER") : (tracking == trackMirror ? F("MIRR") : F("OFF")));
+    break;
+#ifdef PROFILE
+  case ScpiRequest::getTiming:
+  case ScpiRequest::getHistogram:
+  {
+    if (req.value >= PROFILE_SECTIONS)
+    {
+      scpi.error(SCPI_DATA_OUT_OF_RANGE);
+      return;
+    }
+    ProfileSection section = (ProfileSection)req.value;
+    ProfileStats stats;
+    profiler.get(section, stats);
+    char buf[SCPI_OUT_MAX];
+    if (req.type == ScpiRequest::getTiming)
+    {
+      Profiler::getName(section, buf);
+      uint8_t n = strlen(buf);
+      snprintf_P(buf + n, sizeof(buf) - n, PSTR(",%lu,%u,%u,%u"), (unsigned long)stats.count,
+                 stats.count ? stats.min : 0, stats.getMean(), stats.max);
+    }
+    else
+    {
+      char *p = buf;
+      for (uint8_t i = 0; i < PROFILE_BUCKETS; i++)
+      {
+        p += snprintf_P(p, buf + sizeof(buf) - p, i ? PSTR(",%u") : PSTR("%u"), stats.histogram[i]);
+      }
+    }
+    scpi.reply(buf);
+    break;
+  }
+  case ScpiRequest::getTask:
+  {
+    if (req.value >= scheduler.getCount())
+    {
+      scpi.error(SCPI_DATA_OUT_OF_RANGE);
+      return;
+    }
+    Task &t = scheduler.getTask(req.value);
+    char buf[48];
+    strlcpy_P(buf, (const char *)t.name, sizeof(buf));
+    uint8_t n = strlen(buf);
+    snprintf_P(buf + n, sizeof(buf) - n, PSTR(",%lu,%u,%u,%u,%u"), (unsigned long)t.runs, t.lastUs, t.maxUs, t.maxLate,
+               t.skipped);
+    scpi.reply(buf);
+    break;
+  }
+  case ScpiRequest::resetTiming:
+    profiler.reset();
+    scheduler.resetStats();
+    break;
+  case ScpiRequest::setDiagDisplay:
+    if (overTemp)
+    {
+      scpi.error(SCPI_SETTINGS_CONFLICT);
+    }
+    else if (req.value)
+    {
+      display.diagnostics();
+    }
+    else if (display.isDiagnostics())
+    {
+      display.normal();
+    }
+    break;
+  case ScpiRequest::getMemory:
+  {
+    char buf[8];
+    snprintf_P(buf, sizeof(buf), PSTR("%u"), hal::stackHeadroom());
+    scpi.reply(buf);
+    break;
+  }
+#endif
+  }
+}
+
+void onFanTach()
+{
+  tempControl.onTachPulse();
+}
+
+// Sets the DACs from the setpoints (derated if need be), or to zero with the
+// output off, leaving out any output a sweep or a list has taken over. All
+// of them are loaded before any is latched, so tracking outputs change in
+// the same instant.
+void applySetpoints()
+{
+  uint16_t volt[NUM_CHANNELS], amp[NUM_CHANNELS];
+  for (uint8_t c = 0; c < NUM_CHANNELS; c++)
+  {
+    Channel &ch = channels[c];
+    bool on = isOutputOn(c);
+    volt[c] = on ? ch.trim.apply(ch.toVoltCode(targetVolt(c))) : 0;
+    amp[c] = on ? ch.toAmpCode(min(targetAmp(c), iDerated)) : 0;
+  }
+  uint8_t state = hal::disableInterrupts();
+  for (uint8_t c = 0; c < NUM_CHANNELS; c++)
+  {
+    if (!isTakenOver(c))
+    {
+      loadOutputs(c, volt[c], amp[c]);
+    }
+  }
+  for (uint8_t c = 0; c < NUM_CHANNELS; c++)
+  {
+    if (!isTakenOver(c))
+    {
+      channels[c].dac.latch();
+    }
+  }
+  hal::restoreInterrupts(state);
+}
+
+// Sets the DAC to the nominal code for the current point of the calibration
+// sweep, bypassing the calibration and trim
+void applyCalibrationStep()
+{
+  uint32_t nominal = calSweep.getSetpoint();
+  hal::Dac &dac = channels[calChannel].dac;
+  if (calSweep.getOutput() == calVOutput)
+  {
+    writeOutputs(calChannel, ((uint32_t)dac.maxValue() * nominal) / MAX_MV, dac.maxValue());
+  }
+  else
+  {
+    writeOutputs(calChannel, ((uint32_t)dac.maxValue() * CAL_SHORT_MV) / MAX_MV, ((uint32_t)dac.maxValue() * nominal) / MAX_MA);
+  }
+}
+
+// Reads the lock switch, the dials and remote commands, and writes the DAC
+void controlTask()
 {
   // Settings lock enabled?
   bool releaseLock = false;
-  if (digitalRead(LOCK_PIN) == 0)
+  if (hal::Pin<LOCK_PIN>::read() == LOW)
   {
     if (!locked)
     {
@@ -192,69 +1024,474 @@ void loop()
       display.setLockedMode(false);
       locked = false;
       releaseLock = true;
+
+      // Cycling the lock switch is the front panel way of clearing a trip
+      clearTrip();
+    }
+  }
+
+  // Remote commands go before the dials so a new setpoint reaches the DAC in this pass
+  ScpiRequest req;
+  if (scpi.poll(req))
+  {
+    Readings r = readings.read();
+    handleScpi(req, r);
+  }
+
+  // A calibration sweep takes over the DAC until it stops
+  if (calSweep.takeChange())
+  {
+    if (calSweep.isRunning())
+    {
+      applyCalibrationStep();
+    }
+    else
+    {
+      // The calibration may have changed, so the limits must follow
+      channels[calChannel].updateProtection();
+      channels[calChannel].trim.setpointChanged();
+      writeDac = true;
     }
   }
 
+  // A list takes over the DAC while armed or running, and hands it back when it stops
+  if (sequencer.takeStop())
+  {
+    channels[listChannel].trim.setpointChanged();
+    writeDac = true;
+  }
+
+  // The meters count what the outputs deliver, which a sweep doesn't
+  for (uint8_t c = 0; c < NUM_CHANNELS; c++)
+  {
+    channels[c].meter.setOn(isOutputOn(c) && !overTemp && !getFault(c) && !(calSweep.isRunning() && c == calChannel));
+  }
+
   // Overtemp? Disble all dials and keep voltage and current at 0.
   if (!overTemp)
   {
-    // Read the dials
+    // Read the dials, which set the selected output
+    Channel &ch = channels[selected];
+#ifdef PROFILE
+    static uint32_t lastPoll = hal::micros();
+    uint32_t poll = hal::micros();
+    bool turned = currentDial.getValue() != (int32_t)ch.iSet || voltageDial.getValue() != (int32_t)ch.vSet;
+#endif
     currentDial.tick();
     voltageDial.tick();
 
     int32_t i = currentDial.getValue();
     int32_t v = voltageDial.getValue();
+#ifdef PROFILE
+    turned = !turned && (i != (int32_t)ch.iSet || v != (int32_t)ch.vSet);
+#endif
 
     // Dials moved?
-    if (i != iSet || v != vSet || releaseLock)
+    if (i != (int32_t)ch.iSet || v != (int32_t)ch.vSet || releaseLock || outputChanged)
     {
-      vSet = v;
-      iSet = i;
+      ch.vSet = v;
+      ch.iSet = i;
+      outputChanged = false;
+      for (uint8_t c = 0; c < NUM_CHANNELS; c++)
+      {
+        if (c == selected || tracking != trackOff)
+        {
+          channels[c].trim.setpointChanged();
+        }
+      }
+      writeDac = true;
+    }
 
-      // Set voltage and current
+    // Set voltage and current. A sweep or a list keeps its output.
+    if (writeDac)
+    {
+      writeDac = false;
       if (!locked)
       {
-        dac.analogWrite(((uint32_t)dac.maxValue() * toCalibratedVOutput(vSet)) / MAX_MV, DAC_VOLTAGE);
-        dac.analogWrite(((uint32_t)dac.maxValue() * toCalibratedIOutput(iSet)) / MAX_MA, DAC_CURRENT);
+        applySetpoints();
+#ifdef PROFILE
+        // A turn could have come right after the previous poll
+        if (turned && isOutputOn(selected))
+        {
+          PROFILE_ADD(profileKnobToDac, hal::micros() - lastPoll);
+        }
+#endif
       }
     }
+#ifdef PROFILE
+    lastPoll = poll;
+#endif
   }
+}
 
-  // Handle overtemp if needed
-  float temp = measTemp.getAvg();
-  if (!overTemp && temp > OVERTEMP_LIMIT_ON)
+// Handles overtemp and shows OVP/OCP trips
+void protectionTask()
+{
+  float temp = readings.read().temp;
+  float junction = thermal.getJunction();
+  if (!overTemp && (temp > OVERTEMP_LIMIT_ON || junction > TJ_TRIP))
   {
     overTemp = true;
-    vSet = 0.0;
-    iSet = 0.0;
-    dac.analogWrite(0, DAC_CURRENT);
-    dac.analogWrite(0, DAC_VOLTAGE);
+    calSweep.abort();
+    sequencer.abort();
+
+    // Only the DACs are zeroed. The setpoints stay as they are, and go back on once it has cooled off.
+    uint8_t state = hal::disableInterrupts();
+    for (uint8_t c = 0; c < NUM_CHANNELS; c++)
+    {
+      loadOutputs(c, 0, 0);
+    }
+    for (uint8_t c = 0; c < NUM_CHANNELS; c++)
+    {
+      channels[c].dac.latch();
+    }
+    hal::restoreInterrupts(state);
     display.overtemp();
   }
-  if (overTemp && temp < OVERTEMP_LIMIT_OFF)
+  if (overTemp && temp < OVERTEMP_LIMIT_OFF && junction < TJ_TARGET)
   {
     overTemp = false;
+    shownFault = 0;
+    for (uint8_t c = 0; c < NUM_CHANNELS; c++)
+    {
+      channels[c].trim.setpointChanged();
+    }
+    writeDac = true;
     display.normal();
   }
 
+  // An OVP or OCP trip is latched in the sampling interrupt and only shown from here
+  uint8_t fault = getFault(selected);
+  if (getFault(calChannel))
+  {
+    calSweep.abort();
+  }
+  if (!overTemp && fault != shownFault)
+  {
+    if (fault)
+    {
+      display.tripped(fault & PROTECT_OVP);
+    }
+    else
+    {
+      display.normal();
+    }
+    shownFault = fault;
+  }
+}
+
+#ifdef PROFILE
+void showDiagnostics()
+{
+  static uint8_t runs = 0;
+  if (runs++ % DIAG_REFRESH)
+  {
+    return;
+  }
+  //  loop 2866 isr   156
+  //  disp 2866 rpm     7
+  //  knob 4012 trip  512
+  //  ovr     0 max us
+  char buf[DISPLAY_COLS + 1];
+  char nameA[PROFILE_NAME_MAX], nameB[PROFILE_NAME_MAX];
+  ProfileStats a, b;
+  for (uint8_t row = 0; row < 2; row++)
+  {
+    profiler.get((ProfileSection)(row * 2), a);
+    profiler.get((ProfileSection)(row * 2 + 1), b);
+    Profiler::getName((ProfileSection)(row * 2), nameA);
+    Profiler::getName((ProfileSection)(row * 2 + 1), nameB);
+    snprintf_P(buf, sizeof(buf), PSTR("%-4s%5u %-4s%5u"), nameA, a.max, nameB, b.max);
+    display.setTextRow(row, buf);
+  }
+  profiler.get(profileKnobToDac, a);
+  profiler.get(profileTrip, b);
+  snprintf_P(buf, sizeof(buf), PSTR("knob%5u trip%5u"), a.max, b.max);
+  display.setTextRow(2, buf);
+  snprintf_P(buf, sizeof(buf), PSTR("ovr %5u max us"), sampler.getOverruns());
+  display.setTextRow(3, buf);
+}
+#endif
+
+// Shows the progress of a calibration sweep:
+//  CAL VOLTAGE    12/31
+//  SET  12.000
+//  RAW  11.984
+//  ENTER CAL:REF
+void showCalibration()
+{
+  char buf[DISPLAY_COLS + 1];
+  strcpy_P(buf, calSweep.getOutput() == calVOutput ? PSTR("CAL VOLTAGE") : PSTR("CAL CURRENT"));
+  snprintf_P(buf + 11, sizeof(buf) - 11, PSTR("    %2u/%2u"), (uint8_t)(calSweep.getPoint() + 1) % 100,
+             calSweep.getPoints() % 100);
+  display.setTextRow(0, buf);
+  uint16_t set = calSweep.getSetpoint();
+  uint16_t raw = calSweep.getReading();
+  snprintf_P(buf, sizeof(buf), PSTR("SET %3u.%03u"), set / 1000, set % 1000);
+  display.setTextRow(1, buf);
+  snprintf_P(buf, sizeof(buf), PSTR("RAW %3u.%03u"), raw / 1000, raw % 1000);
+  display.setTextRow(2, buf);
+  display.setTextRow(3, calSweep.getState() == CalibrationSweep::reference ? F("ENTER CAL:REF") : F("SETTLING"));
+}
+
+// Shows the charge and energy counters:
+//  Q       12.345 mAh
+//  E      123.456 mWh
+//  T        1:02:03.4
+//  ON
+void showEnergy()
+{
+  static uint8_t runs = 0;
+  if (runs++ % ENERGY_REFRESH)
+  {
+    return;
+  }
+  Channel &ch = channels[selected];
+  EnergyTotals t;
+  ch.meter.read(t);
+  char buf[DISPLAY_COLS + 1];
+  char num[18];
+  formatMilli(num, sizeof(num), t.charge * 1000 / TICKS_PER_HOUR);
+  snprintf_P(buf, sizeof(buf), PSTR("Q %12.12s mAh"), num);
+  display.setTextRow(0, buf);
+  formatMilli(num, sizeof(num), t.energy / TICKS_PER_HOUR);
+  snprintf_P(buf, sizeof(buf), PSTR("E %12.12s mWh"), num);
+  display.setTextRow(1, buf);
+  uint32_t tenths = t.ticks / (CHANNEL_RATE / 10);
+  snprintf_P(buf, sizeof(buf), PSTR("T %10lu:%02u:%02u.%u"), (unsigned long)(tenths / 36000), (uint8_t)(tenths / 600 % 60),
+             (uint8_t)(tenths / 10 % 60), (uint8_t)(tenths % 10));
+  display.setTextRow(2, buf);
+  display.setTextRow(3, ch.meter.isHeld() ? F("HELD") : (isOutputOn(selected) ? F("ON") : F("OFF")));
+}
+
+void displayTask()
+{
+  if (calSweep.isRunning())
+  {
+    if (!display.isCalibration())
+    {
+      display.calibration();
+    }
+    showCalibration();
+    display.refresh();
+    return;
+  }
+  if (display.isCalibration())
+  {
+    display.normal();
+  }
+  if (display.isEnergy())
+  {
+    showEnergy();
+    display.refresh();
+    return;
+  }
+#ifdef PROFILE
+  if (display.isDiagnostics())
+  {
+    showDiagnostics();
+    display.refresh();
+    return;
+  }
+#endif
+  Readings r = readings.read();
+
   // Update display (only updates changed values)
-  display.setVSet(vSet);
-  display.setISet(iSet);
-  display.setTemp(round(temp));
+  display.setVSet(channels[selected].vSet);
+  display.setISet(channels[selected].iSet);
+  display.setTemp(round(r.temp));
   if (!overTemp)
   {
-    float amp = measAmp.getAvg(), volt = measVolt.getAvg();
-
-    // We measure in relation to negative supply. Adjust for drop across sense resistor
-    float calAmp = toCalibratedIReading(amp);
-    float calVolt = toCalibratedVReading(volt);
-    display.setVAct(calVolt);
-    display.setIAct(calAmp);
-    display.setPAct((calAmp * calVolt) / 1000);
+    // We measure in relation to negative supply. The calibration adjusts for the drop across the sense resistor.
+    display.setVAct(measuredVolt(r));
+    display.setIAct(measuredAmp(r));
+    display.setPAct(measuredPower(r));
   }
   display.setRpm(tempControl.getCachedSpeed());
+  display.setList(sequencer.isActive() && listChannel == selected);
   display.refresh();
+}
+
+void fanTask()
+{
+  tempControl.setTemp(readings.read().temp);
+
+  // A stalled fan reads 0 RPM, so the thermal model already derates for still air. This only reports it.
+  bool stalled = tempControl.isStalled();
+  if (stalled != fanStalled)
+  {
+    fanStalled = stalled;
+    display.setFanStalled(stalled);
+  }
+}
+
+// Runs the thermal model and derates the current limit so the junction stays
+// under TJ_TARGET. With more than one output, the pass transistors share the
+// heatsink, so the model takes their total dissipation and the one derated
+// limit applies to all of them. At that limit the dissipation is the limit
+// times the sum of the drops across the outputs that conduct, so an output
+// that is off or tripped doesn't count.
+void thermalTask()
+{
+  Readings r = readings.read();
+  float power = 0, drops = 0;
+  for (uint8_t c = 0; c < NUM_CHANNELS; c++)
+  {
+    float drop = (RECTIFIED_MV - channels[c].cal.toVReading(r.volt[c])) / 1000.0;
+    power += drop * channels[c].cal.toIReading(r.amp[c]) / 1000;
+    if (isOutputOn(c) && !getFault(c))
+    {
+      drops += drop;
+    }
+  }
+  thermal.update(THERMAL_PERIOD / 1e6, power, r.temp, tempControl.getCachedSpeed());
 
-  // Set fan speed
-  tempControl.setTemp(temp);
+  // The current that would dissipate the allowed power at the present output voltages
+  float allowed = drops > 0 ? thermal.getAllowedPower(TJ_TARGET) / drops * 1000 : MAX_MA;
+  uint32_t limit = allowed < MAX_MA ? allowed : MAX_MA;
+  if (limit + DERATE_HYSTERESIS < iDerated || limit > iDerated + DERATE_HYSTERESIS || (limit == MAX_MA && iDerated != MAX_MA))
+  {
+    iDerated = limit;
+    sequencer.setAmpLimit(channels[listChannel].toAmpCode(iDerated));
+    writeDac = true;
+  }
+  display.setDerated(iDerated < targetAmp(selected));
+}
+
+// Saves the settings once they have settled. While locked the dials don't
+// reach the DAC, and in overtemp the output is held at zero, so neither is
+// saved.
+void persistTask()
+{
+  if (!locked && !overTemp)
+  {
+    PersistState state;
+    state.flags = tracking << PERSIST_TRACK_SHIFT;
+    for (uint8_t c = 0; c < NUM_CHANNELS; c++)
+    {
+      state.vSet[c] = channels[c].vSet;
+      state.iSet[c] = channels[c].iSet;
+      state.flags |= channels[c].outputOn ? PERSIST_OUTPUT_ON << c : 0;
+    }
+    persist.update(state);
+  }
+  persist.poll();
+}
+
+// True if the settings are in range, so a record from a mismatched build isn't restored
+bool isValid(const PersistState &state)
+{
+  uint8_t mode = state.flags >> PERSIST_TRACK_SHIFT;
+  if (mode > trackMirror || (NUM_CHANNELS == 1 && mode != trackOff))
+  {
+    return false;
+  }
+  for (uint8_t c = 0; c < NUM_CHANNELS; c++)
+  {
+    uint32_t maxVolt = c == 0 && mode == trackSeries ? (uint32_t)MAX_MV * NUM_CHANNELS : MAX_MV;
+    if (state.vSet[c] > maxVolt || state.iSet[c] > MAX_MA)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+void setup()
+{
+#ifdef PROFILE
+  hal::paintStack();
+#endif
+  hal::setPinMode(FAN_SENSOR_PIN, INPUT_PULLUP);
+  hal::setPinMode(FAN_PWM_PIN, OUTPUT);
+  hal::Pin<LOCK_PIN>::setMode(INPUT_PULLUP);
+  hal::serialBegin(115200);
+  hal::spiBegin();
+  adc.begin();
+  dac.begin(DAC_CS, DAC_LDAC);
+#if NUM_CHANNELS > 1
+  adc2.begin();
+  dac2.begin(DAC2_CS, DAC_LDAC);
+#endif
+
+  // Calibration from EEPROM if there is one, otherwise the built-in tables
+  for (uint8_t c = 0; c < NUM_CHANNELS; c++)
+  {
+    calRegions[c] = channels[c].cal.getRegion();
+  }
+  persist.loadBlock(calRegions, NUM_CHANNELS);
+  for (uint8_t c = 0; c < NUM_CHANNELS; c++)
+  {
+    channels[c].cal.init();
+  }
+  updateProtection();
+
+#ifdef CAL_BENCH
+  // Compare the integer calibration against the original floating point one.
+  // Multiply the times by 16 for cycles on the target.
+  CalBenchResult bench;
+  char buf[80];
+  channels[0].cal.benchmark(bench);
+  snprintf_P(buf, sizeof(buf), PSTR("cal: calls=%lu float=%luus fixed=%luus maxerr=%ld\n"),
+             (unsigned long)bench.calls, (unsigned long)bench.floatUs, (unsigned long)bench.fixedUs, (long)bench.maxError);
+  hal::serialPrint(buf);
+#endif
+
+  // Connect current and voltage dial so coarse mode behaves nicely
+  currentDial.setPeer(&voltageDial);
+  voltageDial.setPeer(&currentDial);
+  currentDial.setAcceleration(currentAcceleration, ACCEL_STEPS(currentAcceleration));
+  voltageDial.setAcceleration(voltageAcceleration, ACCEL_STEPS(voltageAcceleration));
+
+  // Restore the settings from before the power was cut, or start at zero
+  PersistState state;
+  if (persist.restore(state) && isValid(state))
+  {
+    tracking = (Tracking)(state.flags >> PERSIST_TRACK_SHIFT);
+    for (uint8_t c = 0; c < NUM_CHANNELS; c++)
+    {
+      channels[c].vSet = state.vSet[c];
+      channels[c].iSet = state.iSet[c];
+      channels[c].outputOn = state.flags & (PERSIST_OUTPUT_ON << c);
+    }
+  }
+  select(0);
+  applySetpoints();
+  display.init();
+#ifdef PROFILE
+  // Holding the voltage dial down at power up opens the diagnostics page
+  if (hal::Pin<ROTARY_SW_1>::read() == LOW)
+  {
+    display.diagnostics();
+  }
+#endif
+
+  // Initialize cooling system
+  tempControl.begin(onFanTach);
+
+  // Start sampling last, so slow LCD setup doesn't overrun the sample queue
+  sampler.setDivider(SAMPLE_THERM, THERM_DIVIDER);
+  hal::startTimer(1000000 / SAMPLE_RATE, onSample);
+
+  // Everything else runs from the scheduler
+  scheduler.add(F("measure"), consumeSamples, MEASURE_PERIOD, 0);
+  scheduler.add(F("protect"), protectionTask, PROTECT_PERIOD, 1);
+  scheduler.add(F("control"), controlTask, CONTROL_PERIOD, 2);
+  scheduler.add(F("thermal"), thermalTask, THERMAL_PERIOD, 3);
+  scheduler.add(F("fan"), fanTask, FAN_PERIOD, 4);
+  scheduler.add(F("display"), displayTask, DISPLAY_PERIOD, 5);
+  scheduler.add(F("persist"), persistTask, PERSIST_PERIOD, 6);
+}
+
+void loop()
+{
+  bool ran;
+  {
+    PROFILE_SCOPE(profileLoop);
+    ran = scheduler.run();
+  }
+  if (!ran)
+  {
+    hal::idle(scheduler.untilDue());
+  }
 }
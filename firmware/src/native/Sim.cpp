@@ -0,0 +1,253 @@
+// Native simulator driver. Runs the firmware's setup()/loop() against the
+// simulated board and executes a script of stimuli and probes, one command
+// per line, read from the file given on the command line or from stdin:
+//
+//   adc <channel> <code>   Set the raw MCP3202 reading of a channel (0-4095). The second board's are 2 and 3.
+//   analog <pin> <value>   Set the internal ADC reading of a pin (0-1023)
+//   pin <pin> <0|1>        Drive an input pin
+//   tach <pin> <rpm>       Drive a fan tach signal on a pin
+//   enc <pin1> <pin2> <detents> [ms]
+//                          Turn the encoder on pin1/pin2, evenly over ms (default 50 ms per detent)
+//   serial <text>          Send a line of text to the serial port
+//   txrate <bytes/ms>      Limit how fast the host reads serial output (0 for unlimited)
+//   run <ms>               Run loop() for ms of simulated time
+//   loops <n>              Run loop() n times
+//   dac                    Print the DAC codes of every board
+//   lcd                    Print the LCD contents
+//   stats                  Print loop() timing statistics and simulation speed, and reset them
+//   echo <text>            Print text
+//   powerfail              Cut the power, garbling any EEPROM write in progress, and exit
+//   plant <0|1>            Run the analog side from the plant model in SimPlant.hpp. While on, the
+//                          MCP3202, the thermistor and the fan tach follow the model, not adc/analog/tach.
+//   load <mohm> [mA]       Load the output with a resistance (0 for none) and a constant current
+//   ambient <C>            Set the air temperature around the heatsink
+//   probe                  Print the state of the plant
+//   trace <ms> <us>        Run loop() for ms of simulated time, printing the plant state every us
+//
+// Lines starting with # are ignored. Loop timing is reported both as host
+// time and as the estimated I/O time on the target (see sim::COST_*).
+//
+// If a second file is given on the command line (use - for a script on
+// stdin), the EEPROM is loaded from it and saved back to it on exit.
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include "SimDevices.hpp"
+#include "SimPlant.hpp"
+
+void setup();
+void loop();
+
+hal::Lcd *sim::lcd = nullptr;
+
+namespace
+{
+    struct LoopStats
+    {
+        uint32_t n;
+        uint64_t targetMin;
+        uint64_t targetMax;
+        uint64_t targetSum;
+        uint64_t hostSum;
+        uint64_t since; // Simulated time at the last reset
+
+        void reset()
+        {
+            n = 0;
+            since = sim::now();
+            targetMin = UINT64_MAX;
+            targetMax = 0;
+            targetSum = 0;
+            hostSum = 0;
+        }
+    };
+
+    LoopStats stats;
+
+    void runLoop()
+    {
+        uint64_t start = sim::now() - sim::idleTime();
+        std::chrono::steady_clock::time_point hostStart = std::chrono::steady_clock::now();
+        loop();
+        uint64_t hostNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - hostStart).count();
+        if (sim::now() - sim::idleTime() == start)
+        {
+            sim::charge(1);
+        }
+        uint64_t target = sim::now() - sim::idleTime() - start;
+        stats.n++;
+        stats.targetSum += target;
+        stats.hostSum += hostNs;
+        if (target < stats.targetMin)
+        {
+            stats.targetMin = target;
+        }
+        if (target > stats.targetMax)
+        {
+            stats.targetMax = target;
+        }
+    }
+
+    void printStats()
+    {
+        if (stats.n == 0)
+        {
+            printf("stats: no iterations\n");
+            return;
+        }
+        printf("stats: loops=%u target_us min=%llu mean=%llu max=%llu host_ns mean=%llu lcd_bytes=%u speed=%.0fx\n",
+               stats.n,
+               (unsigned long long)stats.targetMin,
+               (unsigned long long)(stats.targetSum / stats.n),
+               (unsigned long long)stats.targetMax,
+               (unsigned long long)(stats.hostSum / stats.n),
+               sim::getLcdBytes(),
+               stats.hostSum ? (sim::now() - stats.since) * 1000.0 / stats.hostSum : 0.0);
+        stats.reset();
+    }
+
+    void run(long ms)
+    {
+        uint64_t end = sim::now() + (uint64_t)ms * 1000;
+        while (sim::now() < end)
+        {
+            runLoop();
+        }
+    }
+
+    bool execute(char *line)
+    {
+        char cmd[16];
+        long a = 0, b = 0, c = 0, d = -1;
+        int n = sscanf(line, "%15s %ld %ld %ld %ld", cmd, &a, &b, &c, &d);
+        if (n < 1 || cmd[0] == '#')
+        {
+            return true;
+        }
+        if (!strcmp(cmd, "adc") && n == 3)
+        {
+            sim::setAdc(a, b);
+        }
+        else if (!strcmp(cmd, "analog") && n == 3)
+        {
+            sim::setAnalog(a, b);
+        }
+        else if (!strcmp(cmd, "pin") && n == 3)
+        {
+            sim::setPin(a, b);
+        }
+        else if (!strcmp(cmd, "tach") && n == 3)
+        {
+            sim::setTach(a, b);
+        }
+        else if (!strcmp(cmd, "enc") && n >= 4)
+        {
+            sim::spinEncoder(a, b, c, (d < 0 ? labs(c) * 50 : d) * 1000);
+        }
+        else if (!strcmp(cmd, "txrate") && n == 2)
+        {
+            sim::setSerialRate(a);
+        }
+        else if (!strcmp(cmd, "run") && n == 2)
+        {
+            run(a);
+        }
+        else if (!strcmp(cmd, "loops") && n == 2)
+        {
+            for (long i = 0; i < a; i++)
+            {
+                runLoop();
+            }
+        }
+        else if (!strcmp(cmd, "dac"))
+        {
+            printf("dac: t=%llu", (unsigned long long)sim::now());
+            for (uint8_t i = 0; i < 2 * sim::getDacs(); i++)
+            {
+                printf(" ch%u=%u", i, sim::getDac(i));
+            }
+            printf("\n");
+        }
+        else if (!strcmp(cmd, "lcd"))
+        {
+            for (int r = 0; sim::lcd && r < SIM_LCD_ROWS; r++)
+            {
+                printf("lcd: |%s|\n", sim::lcd->getRow(r));
+            }
+        }
+        else if (!strcmp(cmd, "stats"))
+        {
+            printStats();
+        }
+        else if (!strcmp(cmd, "serial"))
+        {
+            sim::serialInput(line + strspn(line, " \t") + 7);
+        }
+        else if (!strcmp(cmd, "plant") && n == 2)
+        {
+            sim::plant.setOn(a);
+        }
+        else if (!strcmp(cmd, "load") && n >= 2)
+        {
+            sim::plant.setLoad(a / 1000.0, n > 2 ? b / 1000.0 : 0);
+        }
+        else if (!strcmp(cmd, "ambient") && n == 2)
+        {
+            sim::plant.setAmbient(a);
+        }
+        else if (!strcmp(cmd, "probe"))
+        {
+            sim::plant.update();
+            sim::plant.print();
+        }
+        else if (!strcmp(cmd, "trace") && n == 3)
+        {
+            sim::plant.trace(sim::now() + (uint64_t)a * 1000, b);
+            run(a);
+            sim::plant.update();
+        }
+        else if (!strcmp(cmd, "powerfail"))
+        {
+            sim::powerFail();
+        }
+        else if (!strcmp(cmd, "echo"))
+        {
+            printf("%s", line + strspn(line, " \t") + 4);
+        }
+        else
+        {
+            fprintf(stderr, "sim: bad command: %s", line);
+            return false;
+        }
+        return true;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    FILE *script = stdin;
+    if (argc > 1 && strcmp(argv[1], "-") && !(script = fopen(argv[1], "r")))
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    sim::useEepromFile(argc > 2 ? argv[2] : nullptr);
+
+    // Thermistor at 25C and an idle fan until the script says otherwise
+    sim::setAnalog(A0, 512);
+    stats.reset();
+    setup();
+
+    char line[256];
+    while (fgets(line, sizeof(line), script))
+    {
+        if (!execute(line))
+        {
+            return 1;
+        }
+    }
+    sim::saveEeprom();
+    return 0;
+}
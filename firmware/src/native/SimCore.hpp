@@ -0,0 +1,280 @@
+/*
+Copyright 2023, Pontus Rydin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in
+the Software without restriction, including without limitation the rights to use,
+copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+// Native (Linux) side of the HAL. Provides the small subset of the Arduino
+// core the firmware relies on (types, pin constants, min/max, the flash
+// data macros) plus the hal:: functions, backed by the simulated board
+// in SimHal.cpp.
+
+#ifndef __SIM_CORE_HPP
+#define __SIM_CORE_HPP
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+// Analog pin numbering on the 32u4
+#define A0 18
+
+// Flash and RAM share one address space on the host
+#define PROGMEM
+#define PSTR(s) (s)
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+#define snprintf_P snprintf
+#define strcpy_P strcpy
+#define strlen_P strlen
+#define memcpy_P memcpy
+
+class __FlashStringHelper;
+
+#define SIM_NUM_PINS 32
+#define SIM_BOARDS 2 // Output boards, each with an MCP3202 and an MCP4922
+#define HAL_NO_PIN 0xff
+#define HAL_EEPROM_SIZE 1024
+
+template <class T, class L>
+inline auto min(const T &a, const L &b) -> decltype(b < a ? b : a)
+{
+    return (b < a) ? b : a;
+}
+
+template <class T, class L>
+inline auto max(const T &a, const L &b) -> decltype(b < a ? b : a)
+{
+    return (a < b) ? b : a;
+}
+
+inline size_t strlcpy_P(char *dst, const char *src, size_t size)
+{
+    size_t n = strlen(src);
+    if (size)
+    {
+        size_t m = n < size - 1 ? n : size - 1;
+        memcpy(dst, src, m);
+        dst[m] = 0;
+    }
+    return n;
+}
+
+namespace hal
+{
+    void setPinMode(uint8_t pin, uint8_t mode);
+
+    uint8_t readPin(uint8_t pin);
+
+    void writePin(uint8_t pin, uint8_t value);
+
+    void writePwm(uint8_t pin, uint8_t duty);
+
+    void startAnalog(uint8_t pin);
+
+    bool analogReady();
+
+    int readAnalogResult();
+
+    typedef __FlashStringHelper FlashString;
+
+    inline int16_t readFlashWord(const int16_t *p)
+    {
+        return *p;
+    }
+
+    inline uint8_t readFlashByte(const uint8_t *p)
+    {
+        return *p;
+    }
+
+    inline char readFlashChar(const FlashString *s, uint8_t i)
+    {
+        return ((const char *)s)[i];
+    }
+
+    // The host stack isn't the target's, so there is nothing to measure
+    inline uint16_t stackHeadroom()
+    {
+        return 0;
+    }
+
+    inline void paintStack()
+    {
+    }
+
+    uint32_t micros();
+
+    uint32_t millis();
+
+    void idle(uint32_t us);
+
+    void serialBegin(uint32_t baud);
+
+    void serialPrint(const char *s);
+
+    int serialAvailable();
+
+    int serialRead();
+
+    int serialAvailableForWrite();
+
+    void serialWrite(const uint8_t *buf, size_t n);
+
+    void spiBegin();
+
+    void attachPinInterrupt(uint8_t pin, void (*callback)(), uint8_t mode);
+
+    uint8_t disableInterrupts();
+
+    void restoreInterrupts(uint8_t state);
+
+    void startTimer(uint32_t intervalUs, void (*callback)());
+
+    uint8_t eepromRead(uint16_t addr);
+
+    bool eepromReady();
+
+    void eepromWrite(uint16_t addr, uint8_t value);
+}
+
+// Simulator control. Used by the fake devices and the script driver.
+namespace sim
+{
+    // Estimated cost on the 32u4 @ 16 MHz (microseconds). Only I/O is modeled;
+    // computation is measured separately using the host clock.
+    const uint32_t COST_PIN = 3;        // digitalRead/digitalWrite with pin table lookup
+    const uint32_t COST_PWM = 5;        // analogWrite
+    const uint32_t COST_ANALOG_START = 2; // Selecting the channel and starting a conversion
+    const uint32_t COST_ANALOG_READ = 1;  // Reading a finished conversion
+    const uint32_t ANALOG_TIME = 104;     // Internal ADC conversion (13 cycles @ 125 kHz)
+    const uint32_t COST_MICROS = 2;     // micros()/millis()
+    const uint32_t COST_ADC_READ = 28;  // MCP3202 conversion, 3 bytes @ 1 MHz SPI + chip select
+    const uint32_t COST_DAC_LOAD = 3;   // MCP4922 input register write, 2 bytes @ 8 MHz + chip select
+    const uint32_t COST_DAC_LATCH = 1;  // LDAC pulse
+    const uint32_t COST_LCD_BYTE = 550; // One character or command through the PCF8574 @ 100 kHz
+    const uint32_t COST_LCD_CLEAR = 2000;
+    const uint32_t COST_SERIAL_BYTE = 1; // Copy to or from the USB CDC endpoint
+    const uint32_t COST_EEPROM_READ = 1;
+    const uint32_t COST_EEPROM_WRITE = 2; // Starting a write. The write itself takes EEPROM_WRITE_TIME.
+    const uint32_t EEPROM_WRITE_TIME = 3400;
+
+    // Advances virtual time, firing any timer and pin interrupts that fall due.
+    // Time spent in interrupts is added on top.
+    void charge(uint32_t us);
+
+    uint64_t now();
+
+    // Total time skipped by hal::idle()
+    uint64_t idleTime();
+
+    void setPin(uint8_t pin, uint8_t value);
+
+    uint8_t getPin(uint8_t pin);
+
+    uint8_t getPwm(uint8_t pin);
+
+    void setAnalog(uint8_t pin, int value);
+
+    // Drives a pin with a square wave of one period per revolution.
+    void setTach(uint8_t pin, uint16_t rpm);
+
+    // MCP3202 and MCP4922 channels are numbered 2 * board + channel, with
+    // boards numbered in the order their drivers are begun.
+    void setAdc(uint8_t channel, uint16_t code);
+
+    uint16_t getAdc(uint8_t channel);
+
+    void setDac(uint8_t channel, uint16_t code);
+
+    uint16_t getDac(uint8_t channel);
+
+    // Board numbers for a new ADC or DAC driver
+    uint8_t addAdc();
+
+    uint8_t addDac();
+
+    // DACs begun so far
+    uint8_t getDacs();
+
+    // Drives the quadrature encoder on pin1/pin2 through the given number of
+    // detents, evenly spread over durationUs starting now.
+    void spinEncoder(uint8_t pin1, uint8_t pin2, int32_t detents, uint32_t durationUs);
+
+    // Queues text as if the host had sent it over the serial port
+    void serialInput(const char *s);
+
+    // Limits how fast the host drains serial output, in bytes per ms (0 for unlimited)
+    void setSerialRate(uint32_t bytesPerMs);
+
+    // Loads the EEPROM contents from a file, if it exists, and saves them back
+    // to it on exit, so a script can be run again as if after a power cycle.
+    // Without a file, the EEPROM starts out erased.
+    void useEepromFile(const char *path);
+
+    void saveEeprom();
+
+    // Cuts the power: a write in progress leaves the byte garbled, and the
+    // simulator saves the EEPROM and exits.
+    void powerFail();
+
+    void noteLcdBytes(uint32_t n);
+
+    uint32_t getLcdBytes();
+}
+
+namespace hal
+{
+    // Pins known at compile time. On the target these are single port
+    // instructions, well under the microsecond the simulated clock counts
+    // in, so they cost nothing here.
+    template <uint8_t pin>
+    class Pin
+    {
+        static_assert(pin < SIM_NUM_PINS, "no such pin");
+
+    public:
+        static void setMode(uint8_t mode)
+        {
+            setPinMode(pin, mode);
+        }
+
+        static uint8_t read()
+        {
+            return sim::getPin(pin);
+        }
+
+        static void write(uint8_t value)
+        {
+            sim::setPin(pin, value);
+        }
+    };
+}
+#endif
@@ -0,0 +1,226 @@
+/*
+Copyright 2023, Pontus Rydin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in
+the Software without restriction, including without limitation the rights to use,
+copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+// Simulated peripherals. Each class mirrors the subset of the API of the
+// device library it stands in for, so firmware code is identical on both
+// targets.
+
+#ifndef __SIM_DEVICES_HPP
+#define __SIM_DEVICES_HPP
+#include "SimCore.hpp"
+
+#define SIM_LCD_COLS 20
+#define SIM_LCD_ROWS 4
+
+namespace hal
+{
+    class Lcd;
+}
+
+namespace sim
+{
+    // The most recently constructed LCD, so the simulator can show it
+    extern hal::Lcd *lcd;
+}
+
+namespace hal
+{
+    // Stands in for the MCP3202 driver
+    class Adc
+    {
+    public:
+        Adc(uint8_t csPin) : csPin(csPin)
+        {
+        }
+
+        void begin()
+        {
+            board = sim::addAdc();
+        }
+
+        uint16_t readChannel(uint8_t channel)
+        {
+            sim::charge(sim::COST_ADC_READ);
+            return sim::getAdc(2 * board + (channel & 1));
+        }
+
+    private:
+        uint8_t csPin;
+        uint8_t board = 0;
+    };
+
+    // Stands in for the MCP4922 driver. Loaded values only reach the
+    // simulated outputs on latch(), or right away without an LDAC pin.
+    class Dac
+    {
+    public:
+        void begin(uint8_t csPin, uint8_t ldacPin)
+        {
+            this->csPin = csPin;
+            this->ldacPin = ldacPin;
+            board = sim::addDac();
+        }
+
+        uint16_t maxValue()
+        {
+            return 4095;
+        }
+
+        void load(uint8_t channel, uint16_t value)
+        {
+            sim::charge(sim::COST_DAC_LOAD);
+            input[channel & 1] = value > 4095 ? 4095 : value;
+            if (ldacPin == HAL_NO_PIN)
+            {
+                sim::setDac(2 * board + (channel & 1), input[channel & 1]);
+            }
+        }
+
+        void latch()
+        {
+            if (ldacPin != HAL_NO_PIN)
+            {
+                sim::charge(sim::COST_DAC_LATCH);
+                sim::setDac(2 * board, input[0]);
+                sim::setDac(2 * board + 1, input[1]);
+            }
+        }
+
+    private:
+        uint8_t csPin = 0;
+        uint8_t ldacPin = HAL_NO_PIN;
+        uint8_t board = 0;
+        uint16_t input[2] = {};
+    };
+
+    // Stands in for LiquidCrystal_I2C. Keeps a copy of what's on the glass.
+    class Lcd
+    {
+    public:
+        Lcd(uint8_t /*addr*/, uint8_t /*cols*/, uint8_t /*rows*/)
+        {
+            clearGlass();
+            sim::lcd = this;
+        }
+
+        void init()
+        {
+            send(4);
+            clear();
+        }
+
+        void createChar(uint8_t /*location*/, const char * /*charmap*/)
+        {
+            send(9);
+        }
+
+        void backlight()
+        {
+            send(1);
+        }
+
+        void clear()
+        {
+            send(1);
+            sim::charge(sim::COST_LCD_CLEAR);
+            clearGlass();
+            col = 0;
+            row = 0;
+        }
+
+        void setCursor(uint8_t c, uint8_t r)
+        {
+            send(1);
+            col = c;
+            row = r;
+        }
+
+        void cursor()
+        {
+            send(1);
+        }
+
+        void noCursor()
+        {
+            send(1);
+        }
+
+        void blink()
+        {
+            send(1);
+        }
+
+        void noBlink()
+        {
+            send(1);
+        }
+
+        size_t write(uint8_t c)
+        {
+            send(1);
+            if (row < SIM_LCD_ROWS && col < SIM_LCD_COLS)
+            {
+                glass[row][col] = c;
+            }
+            col++;
+            return 1;
+        }
+
+        size_t print(const char *s)
+        {
+            size_t n = 0;
+            while (*s)
+            {
+                n += write(*s++);
+            }
+            return n;
+        }
+
+        // Returns one row of the glass as a zero terminated string
+        const char *getRow(uint8_t r)
+        {
+            return glass[r];
+        }
+
+    private:
+        char glass[SIM_LCD_ROWS][SIM_LCD_COLS + 1];
+        uint8_t col = 0;
+        uint8_t row = 0;
+
+        void send(uint32_t n)
+        {
+            sim::noteLcdBytes(n);
+            sim::charge(n * sim::COST_LCD_BYTE);
+        }
+
+        void clearGlass()
+        {
+            for (int r = 0; r < SIM_LCD_ROWS; r++)
+            {
+                memset(glass[r], ' ', SIM_LCD_COLS);
+                glass[r][SIM_LCD_COLS] = 0;
+            }
+        }
+    };
+}
+#endif
@@ -0,0 +1,574 @@
+#include <stdio.h>
+#include "SimCore.hpp"
+#include "SimPlant.hpp"
+
+#define SIM_MAX_TIMERS 4
+#define SIM_MAX_ENCODERS 4
+#define SIM_SERIAL_BUFFER 4096
+#define SIM_SERIAL_TX_ROOM 63 // Free space in the CDC endpoint on the 32u4
+
+namespace
+{
+    struct Timer
+    {
+        uint64_t interval;
+        uint64_t due;
+        void (*callback)();
+    };
+
+    struct PinInterrupt
+    {
+        void (*callback)();
+        uint8_t mode;
+        uint64_t nextEdge; // Next tach edge, if the pin is driven by a tach signal
+    };
+
+    // A quadrature encoder being turned. Positions count steps (half detents).
+    struct EncoderSpin
+    {
+        uint8_t pin1;
+        uint8_t pin2;
+        int32_t from;
+        int32_t to;
+        uint64_t start;
+        uint64_t duration;
+
+        int32_t position(uint64_t t)
+        {
+            if (t >= start + duration)
+            {
+                return to;
+            }
+            return from + (int64_t)(to - from) * (int64_t)(t - start) / (int64_t)duration;
+        }
+    };
+
+    uint64_t clock = 0;
+    uint64_t idled = 0;
+    bool inIsr = false;
+    bool masked = false;
+
+    uint8_t pins[SIM_NUM_PINS];
+    uint8_t pwm[SIM_NUM_PINS];
+    int analog[SIM_NUM_PINS];
+    int analogResult = 0;       // Sampled when the conversion starts, like the ADC's sample and hold
+    uint64_t analogDoneAt = 0;
+    uint16_t tach[SIM_NUM_PINS];
+    PinInterrupt pinInterrupts[SIM_NUM_PINS];
+    uint16_t adc[2 * SIM_BOARDS];
+    uint16_t dac[2 * SIM_BOARDS];
+    uint8_t adcs = 0;
+    uint8_t dacs = 0;
+    uint32_t lcdBytes = 0;
+
+    uint32_t serialRate = 0;  // Bytes per ms the host drains, 0 for unlimited
+    uint32_t serialQueued = 0; // Bytes written but not yet drained by the host
+    uint64_t serialDrained = 0;
+
+    uint8_t eeprom[HAL_EEPROM_SIZE];
+    uint64_t eepromBusyUntil = 0;
+    int32_t eepromWriting = -1; // Address of the last write started
+    const char *eepromFile = nullptr;
+
+    char serialIn[SIM_SERIAL_BUFFER];
+    uint16_t serialInHead = 0;
+    uint16_t serialInTail = 0;
+
+    Timer timers[SIM_MAX_TIMERS];
+    int numTimers = 0;
+
+    EncoderSpin encoders[SIM_MAX_ENCODERS];
+    int numEncoders = 0;
+
+    void runIsr(void (*callback)())
+    {
+        inIsr = true;
+        callback();
+        inIsr = false;
+    }
+
+    bool edgeMatches(uint8_t mode, uint8_t value)
+    {
+        return mode == CHANGE || (mode == RISING && value == HIGH) || (mode == FALLING && value == LOW);
+    }
+
+    // First edge of a tach signal after t that the interrupt on the pin cares about
+    uint64_t nextTachEdge(uint8_t pin, uint64_t t)
+    {
+        uint64_t halfPeriod = 30000000UL / tach[pin];
+        uint64_t edge = (t / halfPeriod + 1) * halfPeriod;
+        if (pinInterrupts[pin].mode != CHANGE && !edgeMatches(pinInterrupts[pin].mode, (edge / halfPeriod) & 1 ? HIGH : LOW))
+        {
+            edge += halfPeriod;
+        }
+        return edge;
+    }
+
+    void drainSerial()
+    {
+        if (serialRate == 0)
+        {
+            serialQueued = 0;
+            return;
+        }
+        uint64_t n = (clock - serialDrained) * serialRate / 1000;
+        if (n > 0)
+        {
+            serialQueued = n >= serialQueued ? 0 : serialQueued - n;
+            serialDrained = clock;
+        }
+    }
+
+    EncoderSpin *findEncoder(uint8_t pin)
+    {
+        for (int i = 0; i < numEncoders; i++)
+        {
+            if (encoders[i].pin1 == pin || encoders[i].pin2 == pin)
+            {
+                return &encoders[i];
+            }
+        }
+        return nullptr;
+    }
+}
+
+void hal::setPinMode(uint8_t pin, uint8_t mode)
+{
+    if (pin < SIM_NUM_PINS && mode == INPUT_PULLUP)
+    {
+        pins[pin] = HIGH;
+    }
+}
+
+uint8_t hal::readPin(uint8_t pin)
+{
+    sim::charge(sim::COST_PIN);
+    return sim::getPin(pin);
+}
+
+void hal::writePin(uint8_t pin, uint8_t value)
+{
+    sim::charge(sim::COST_PIN);
+    sim::setPin(pin, value);
+}
+
+void hal::writePwm(uint8_t pin, uint8_t duty)
+{
+    sim::charge(sim::COST_PWM);
+    if (pin < SIM_NUM_PINS)
+    {
+        pwm[pin] = duty;
+    }
+}
+
+void hal::startAnalog(uint8_t pin)
+{
+    sim::charge(sim::COST_ANALOG_START);
+    if (pin == PLANT_THERM_PIN && sim::plant.isOn())
+    {
+        analogResult = sim::plant.readThermistor();
+    }
+    else
+    {
+        analogResult = pin < SIM_NUM_PINS ? analog[pin] : 0;
+    }
+    analogDoneAt = clock + sim::ANALOG_TIME;
+}
+
+bool hal::analogReady()
+{
+    return clock >= analogDoneAt;
+}
+
+int hal::readAnalogResult()
+{
+    sim::charge(sim::COST_ANALOG_READ);
+    return analogResult;
+}
+
+uint32_t hal::micros()
+{
+    sim::charge(sim::COST_MICROS);
+    return (uint32_t)clock;
+}
+
+void hal::idle(uint32_t us)
+{
+    idled += us;
+    sim::charge(us);
+}
+
+uint32_t hal::millis()
+{
+    sim::charge(sim::COST_MICROS);
+    return (uint32_t)(clock / 1000);
+}
+
+void hal::serialBegin(uint32_t /*baud*/)
+{
+}
+
+void hal::serialPrint(const char *s)
+{
+    fputs(s, stdout);
+}
+
+int hal::serialAvailable()
+{
+    return serialInHead - serialInTail;
+}
+
+int hal::serialRead()
+{
+    if (serialInTail == serialInHead)
+    {
+        return -1;
+    }
+    sim::charge(sim::COST_SERIAL_BYTE);
+    return (uint8_t)serialIn[serialInTail++ % SIM_SERIAL_BUFFER];
+}
+
+int hal::serialAvailableForWrite()
+{
+    drainSerial();
+    return serialQueued >= SIM_SERIAL_TX_ROOM ? 0 : SIM_SERIAL_TX_ROOM - serialQueued;
+}
+
+void hal::serialWrite(const uint8_t *buf, size_t n)
+{
+    sim::charge(n * sim::COST_SERIAL_BYTE);
+    drainSerial();
+    serialQueued += n;
+    fwrite(buf, 1, n, stdout);
+}
+
+void hal::spiBegin()
+{
+}
+
+void hal::attachPinInterrupt(uint8_t pin, void (*callback)(), uint8_t mode)
+{
+    if (pin < SIM_NUM_PINS)
+    {
+        pinInterrupts[pin].callback = callback;
+        pinInterrupts[pin].mode = mode;
+        if (tach[pin])
+        {
+            pinInterrupts[pin].nextEdge = nextTachEdge(pin, clock);
+        }
+    }
+}
+
+uint8_t hal::disableInterrupts()
+{
+    uint8_t state = masked;
+    masked = true;
+    return state;
+}
+
+void hal::restoreInterrupts(uint8_t state)
+{
+    masked = state;
+    if (!masked)
+    {
+        // Run anything that fell due while interrupts were off
+        sim::charge(0);
+    }
+}
+
+void hal::startTimer(uint32_t intervalUs, void (*callback)())
+{
+    if (numTimers == SIM_MAX_TIMERS)
+    {
+        fprintf(stderr, "sim: out of timers\n");
+        return;
+    }
+    Timer &t = timers[numTimers++];
+    t.interval = intervalUs;
+    t.due = clock + t.interval;
+    t.callback = callback;
+}
+
+uint8_t hal::eepromRead(uint16_t addr)
+{
+    if (clock < eepromBusyUntil)
+    {
+        sim::charge(eepromBusyUntil - clock);
+    }
+    sim::charge(sim::COST_EEPROM_READ);
+    return addr < HAL_EEPROM_SIZE ? eeprom[addr] : 0xff;
+}
+
+bool hal::eepromReady()
+{
+    return clock >= eepromBusyUntil;
+}
+
+void hal::eepromWrite(uint16_t addr, uint8_t value)
+{
+    if (clock < eepromBusyUntil)
+    {
+        sim::charge(eepromBusyUntil - clock);
+    }
+    sim::charge(sim::COST_EEPROM_WRITE);
+    if (addr < HAL_EEPROM_SIZE)
+    {
+        eeprom[addr] = value;
+        eepromWriting = addr;
+    }
+    eepromBusyUntil = clock + sim::EEPROM_WRITE_TIME;
+}
+
+void sim::charge(uint32_t us)
+{
+    uint64_t target = clock + us;
+    if (inIsr || masked)
+    {
+        clock = target;
+        return;
+    }
+    for (;;)
+    {
+        // Find the earliest pending interrupt
+        uint64_t due = target + 1;
+        Timer *timer = nullptr;
+        int pin = -1;
+        for (int i = 0; i < numTimers; i++)
+        {
+            if (timers[i].due < due)
+            {
+                due = timers[i].due;
+                timer = &timers[i];
+            }
+        }
+        for (int i = 0; i < SIM_NUM_PINS; i++)
+        {
+            if (tach[i] && pinInterrupts[i].callback && pinInterrupts[i].nextEdge < due)
+            {
+                due = pinInterrupts[i].nextEdge;
+                timer = nullptr;
+                pin = i;
+            }
+        }
+        if (due > target)
+        {
+            break;
+        }
+        if (due > clock)
+        {
+            clock = due;
+        }
+        uint64_t start = clock;
+        if (timer)
+        {
+            timer->due += timer->interval;
+            runIsr(timer->callback);
+        }
+        else
+        {
+            pinInterrupts[pin].nextEdge = nextTachEdge(pin, due);
+            runIsr(pinInterrupts[pin].callback);
+        }
+        target += clock - start;
+    }
+    clock = target;
+}
+
+uint64_t sim::now()
+{
+    return clock;
+}
+
+uint64_t sim::idleTime()
+{
+    return idled;
+}
+
+void sim::setPin(uint8_t pin, uint8_t value)
+{
+    if (pin >= SIM_NUM_PINS)
+    {
+        return;
+    }
+    uint8_t old = sim::getPin(pin);
+    pins[pin] = value ? HIGH : LOW;
+    tach[pin] = 0;
+    PinInterrupt &irq = pinInterrupts[pin];
+    if (irq.callback && old != pins[pin] && edgeMatches(irq.mode, pins[pin]) && !masked && !inIsr)
+    {
+        runIsr(irq.callback);
+    }
+}
+
+uint8_t sim::getPin(uint8_t pin)
+{
+    if (pin >= SIM_NUM_PINS)
+    {
+        return LOW;
+    }
+    EncoderSpin *e = findEncoder(pin);
+    if (e)
+    {
+        // Steps go 0, 2, 3, 1 in (pin2 << 1 | pin1); detents rest at 0 and 3
+        static const uint8_t states[4] = {0, 2, 3, 1};
+        uint8_t state = states[e->position(clock) & 3];
+        return pin == e->pin1 ? state & 1 : state >> 1;
+    }
+    if (tach[pin])
+    {
+        uint64_t halfPeriod = 30000000UL / tach[pin];
+        return (clock / halfPeriod) & 1 ? HIGH : LOW;
+    }
+    return pins[pin];
+}
+
+uint8_t sim::getPwm(uint8_t pin)
+{
+    return pin < SIM_NUM_PINS ? pwm[pin] : 0;
+}
+
+void sim::setAnalog(uint8_t pin, int value)
+{
+    if (pin < SIM_NUM_PINS)
+    {
+        analog[pin] = value;
+    }
+}
+
+void sim::setTach(uint8_t pin, uint16_t rpm)
+{
+    if (pin < SIM_NUM_PINS)
+    {
+        tach[pin] = rpm;
+        if (rpm)
+        {
+            pinInterrupts[pin].nextEdge = nextTachEdge(pin, clock);
+        }
+    }
+}
+
+void sim::setAdc(uint8_t channel, uint16_t code)
+{
+    adc[channel % (2 * SIM_BOARDS)] = code > 4095 ? 4095 : code;
+}
+
+uint16_t sim::getAdc(uint8_t channel)
+{
+    // The plant only models the first board
+    if (plant.isOn() && channel < 2)
+    {
+        return plant.readAdc(channel);
+    }
+    return adc[channel % (2 * SIM_BOARDS)];
+}
+
+void sim::setDac(uint8_t channel, uint16_t code)
+{
+    // The plant has seen the old code until now
+    plant.update();
+    dac[channel % (2 * SIM_BOARDS)] = code;
+}
+
+uint16_t sim::getDac(uint8_t channel)
+{
+    return dac[channel % (2 * SIM_BOARDS)];
+}
+
+uint8_t sim::addAdc()
+{
+    return adcs < SIM_BOARDS ? adcs++ : SIM_BOARDS - 1;
+}
+
+uint8_t sim::addDac()
+{
+    return dacs < SIM_BOARDS ? dacs++ : SIM_BOARDS - 1;
+}
+
+uint8_t sim::getDacs()
+{
+    return dacs;
+}
+
+void sim::spinEncoder(uint8_t pin1, uint8_t pin2, int32_t detents, uint32_t durationUs)
+{
+    EncoderSpin *e = findEncoder(pin1);
+    if (!e)
+    {
+        if (numEncoders == SIM_MAX_ENCODERS)
+        {
+            fprintf(stderr, "sim: out of encoders\n");
+            return;
+        }
+        e = &encoders[numEncoders++];
+        e->pin1 = pin1;
+        e->pin2 = pin2;
+        e->to = 2; // Both pins high, as with the pullups and no turn
+        e->duration = 0;
+        e->start = 0;
+    }
+    e->from = e->position(clock);
+    e->to = e->from + detents * 2;
+    e->start = clock;
+    e->duration = durationUs ? durationUs : 1;
+}
+
+void sim::serialInput(const char *s)
+{
+    while (*s && serialInHead - serialInTail < SIM_SERIAL_BUFFER)
+    {
+        serialIn[serialInHead++ % SIM_SERIAL_BUFFER] = *s++;
+    }
+}
+
+void sim::setSerialRate(uint32_t bytesPerMs)
+{
+    drainSerial();
+    serialRate = bytesPerMs;
+    serialDrained = clock;
+}
+
+void sim::useEepromFile(const char *path)
+{
+    memset(eeprom, 0xff, sizeof(eeprom));
+    eepromFile = path;
+    FILE *f = path ? fopen(path, "rb") : nullptr;
+    if (f)
+    {
+        if (fread(eeprom, 1, sizeof(eeprom), f) != sizeof(eeprom))
+        {
+            fprintf(stderr, "sim: short EEPROM file %s\n", path);
+        }
+        fclose(f);
+    }
+}
+
+void sim::saveEeprom()
+{
+    FILE *f = eepromFile ? fopen(eepromFile, "wb") : nullptr;
+    if (f)
+    {
+        fwrite(eeprom, 1, sizeof(eeprom), f);
+        fclose(f);
+    }
+}
+
+void sim::powerFail()
+{
+    if (clock < eepromBusyUntil && eepromWriting >= 0)
+    {
+        eeprom[eepromWriting] ^= 0x5a;
+    }
+    saveEeprom();
+    fflush(stdout);
+    exit(0);
+}
+
+void sim::noteLcdBytes(uint32_t n)
+{
+    lcdBytes += n;
+}
+
+uint32_t sim::getLcdBytes()
+{
+    return lcdBytes;
+}
@@ -0,0 +1,163 @@
+#include <math.h>
+#include <stdio.h>
+#include "SimPlant.hpp"
+
+// Steinhart-Hart coefficients and divider of the thermistor, as in tools/thermistor_table.cpp
+#define THERM_COEFF_A 1.145241779e-3
+#define THERM_COEFF_B 2.314660102e-4
+#define THERM_COEFF_C 0.9841582652e-7
+#define R_THERM_GROUND 10000.0
+
+#define ADC_CODES 4096
+#define VOLT_FULL_SCALE 30.0 // V at the output for full scale on the ADC, through the divider
+
+sim::Plant sim::plant;
+
+void sim::Plant::setOn(bool on)
+{
+    this->on = on;
+    last = now();
+    volt = 0;
+    amp = 0;
+    limiting = false;
+    settled = false;
+    heatsink = params.ambient;
+}
+
+void sim::Plant::setLoad(double ohms, double amps)
+{
+    update();
+    loadOhms = ohms;
+    loadAmps = amps;
+    settled = false;
+}
+
+void sim::Plant::setAmbient(double c)
+{
+    update();
+    params.ambient = c;
+}
+
+void sim::Plant::trace(uint64_t untilUs, uint32_t intervalUs)
+{
+    update();
+    traceInterval = intervalUs ? intervalUs : 1;
+    traceNext = last;
+    traceUntil = untilUs;
+}
+
+void sim::Plant::update()
+{
+    if (!on)
+    {
+        return;
+    }
+    uint16_t fan = getPwm(PLANT_FAN_PWM_PIN) * params.fanMaxRpm / 255;
+    if (fan != rpm)
+    {
+        rpm = fan;
+        setTach(PLANT_FAN_TACH_PIN, rpm);
+    }
+    uint64_t t = now();
+    for (;;)
+    {
+        if (traceInterval && traceNext <= last)
+        {
+            if (traceNext > traceUntil)
+            {
+                traceInterval = 0;
+                continue;
+            }
+            print();
+            traceNext += traceInterval;
+            continue;
+        }
+        if (last >= t)
+        {
+            break;
+        }
+        uint64_t end = settled ? t : min(t, last + PLANT_STEP);
+        if (traceInterval && traceNext < end)
+        {
+            end = traceNext;
+        }
+        step((end - last) / 1e6);
+        last = end;
+    }
+}
+
+void sim::Plant::step(double dt)
+{
+    const PlantParams &p = params;
+    bool same = getDac(PLANT_DAC_VOLTAGE) == voltCode && getDac(PLANT_DAC_CURRENT) == ampCode;
+    voltCode = getDac(PLANT_DAC_VOLTAGE);
+    ampCode = getDac(PLANT_DAC_CURRENT);
+    double target = voltCode * p.dacRef / ADC_CODES * p.voltGain + p.voltSetOffset;
+    double limit = ampCode * p.ampFullScale / ADC_CODES + p.ampSetOffset;
+    double rail = p.railNoLoad - amp * p.railDroop;
+    target = fmax(0, fmin(target, rail - p.dropout - amp * p.senseResistor));
+    limit = fmax(0, limit);
+
+    // Solve the output node at the end of the step. In voltage regulation the
+    // loop sources the load plus C (target - v) / tau; otherwise the source is
+    // pinned at the current limit or, when the output must fall, at zero.
+    double c = p.outputCap;
+    double g = 1 / p.bleeder + (loadOhms > 0 ? 1 / loadOhms : 0);
+    double a = dt / p.loopTau;
+    double v = (volt + a * target) / (1 + a);
+    double i = c * (v - volt) / dt + g * v + loadAmps;
+    limiting = i > limit;
+    if (limiting || i < 0)
+    {
+        i = limiting ? limit : 0;
+        v = (volt + dt / c * (i - loadAmps)) / (1 + dt * g / c);
+    }
+    if (v < 0)
+    {
+        // The constant current load drops out at zero volts
+        v = 0;
+    }
+    settled = same && fabs(v - volt) < 1e-5 && fabs(i - amp) < 1e-6;
+    volt = v;
+    amp = i;
+
+    double power = (rail - volt - amp * p.senseResistor) * amp;
+    double air = p.gStill + p.gPerKrpm * rpm / 1000;
+    heatsink += dt * (power - air * (heatsink - p.ambient)) / p.heatCapacity;
+}
+
+uint16_t sim::Plant::toCode(double v)
+{
+    seed = seed * 1103515245 + 12345;
+    int noise = params.noise ? (int)((seed >> 16) % (2 * params.noise + 1)) - params.noise : 0;
+    long code = lround(v / params.dacRef * ADC_CODES) + noise;
+    return code < 0 ? 0 : code >= ADC_CODES ? ADC_CODES - 1 : code;
+}
+
+uint16_t sim::Plant::readAdc(uint8_t channel)
+{
+    update();
+    if ((channel & 1) == PLANT_ADC_VOLTAGE)
+    {
+        return toCode((volt * params.voltScale + params.voltOffset) * params.dacRef / VOLT_FULL_SCALE);
+    }
+    return toCode((amp * params.ampScale + params.ampOffset) * params.dacRef / params.ampFullScale);
+}
+
+int sim::Plant::readThermistor()
+{
+    update();
+
+    // Steinhart-Hart solved for ln R, a depressed cubic with one real root
+    double p = THERM_COEFF_B / THERM_COEFF_C;
+    double q = (THERM_COEFF_A - 1 / (heatsink + 273.15)) / THERM_COEFF_C;
+    double d = sqrt(q * q / 4 + p * p * p / 27);
+    double r = exp(cbrt(-q / 2 + d) + cbrt(-q / 2 - d));
+    return (int)lround(1023 / (r / R_THERM_GROUND + 1));
+}
+
+void sim::Plant::print()
+{
+    printf("plant: t=%llu v=%.3f i=%.4f %s sink=%.2f rpm=%u\n", (unsigned long long)last, volt, amp,
+           limiting ? "CC" : "CV", heatsink, rpm);
+}
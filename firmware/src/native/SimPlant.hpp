@@ -0,0 +1,152 @@
+/*
+Copyright 2023, Pontus Rydin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in
+the Software without restriction, including without limitation the rights to use,
+copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+// Discrete-time model of the analog side of the supply, so the firmware can
+// be run closed loop in the simulator: the DAC codes drive the model, and the
+// model drives the MCP3202, the thermistor and the fan tach.
+//
+// The regulator is the U1D voltage amplifier (7.32 times the VSET voltage)
+// driving the Darlington as an emitter follower, and the U1A current loop
+// that pulls its base down once the INA225 current sense voltage exceeds
+// ISET. Between them they charge the output capacitor, which the load and the
+// bleeder resistor discharge. The voltage loop is a first order lag, and the
+// pass transistor can only source current, so the output falls only as fast
+// as the load drains the capacitor. The current limit is a hard clamp on the
+// sourced current, which is what the high side sense resistor sees. The
+// output can't rise above the unregulated rail, which sags with the load,
+// less the Darlington and sense resistor drop.
+//
+// The heatsink is one heat capacity losing heat to the air through a
+// conductance that grows with the fan speed, heated by the pass transistor.
+//
+// Each step solves the output node with backward Euler, so it stays stable
+// for any load down to a dead short, and the model advances lazily up to the
+// current simulated time whenever it is read or a DAC output changes. Steps
+// are PLANT_STEP long while anything moves; once the output has settled and
+// the DAC and load are unchanged, one step covers the whole interval.
+
+#ifndef __SIM_PLANT_HPP
+#define __SIM_PLANT_HPP
+#include "SimCore.hpp"
+
+// Wiring, as in main.cpp
+#define PLANT_DAC_VOLTAGE 1
+#define PLANT_DAC_CURRENT 0
+#define PLANT_ADC_VOLTAGE 1
+#define PLANT_ADC_CURRENT 0
+#define PLANT_THERM_PIN A0
+#define PLANT_FAN_PWM_PIN 8
+#define PLANT_FAN_TACH_PIN 0
+
+#define PLANT_STEP 20 // Longest integration step while the output moves (us)
+
+namespace sim
+{
+    // Defaults are the schematic values, with the gain and offset errors of
+    // straight line fits to the shipped tables in Calibration.cpp. Until it is
+    // calibrated against the plant, the firmware reads within a few percent;
+    // the shipped current reading table has bends the plant doesn't.
+    struct PlantParams
+    {
+        double dacRef = 4.096;          // V, LM4040 reference for the DAC and ADC
+        double voltGain = 7.32 * 0.981; // U1D closed loop gain
+        double voltSetOffset = 0.014;   // V at the output, U1D input offset times its gain
+        double ampFullScale = 2.0;      // A at full scale ISET
+        double ampSetOffset = 0.005;    // A, U1A input offset
+        double loopTau = 100e-6;        // s, voltage loop time constant
+        double outputCap = 100e-6;      // F, C1
+        double bleeder = 3900;          // ohm, R7 across the output
+        double railNoLoad = 38.0;       // V, rectified and smoothed
+        double railDroop = 1.5;         // ohm, transformer and rectifier
+        double dropout = 1.6;           // V, Darlington base-emitter and U1D headroom
+        double senseResistor = 0.5;     // ohm, in series with the pass transistor
+        double voltScale = 1.0255;      // Divider error of the voltage measurement
+        double voltOffset = 0.133;      // V
+        double ampScale = 0.952;        // INA225 and U1B gain error of the current measurement
+        double ampOffset = 0.019;       // A
+        int noise = 1;                  // ADC codes of noise, either way
+        double heatCapacity = 250;      // J/K, heatsink
+        double gStill = 0.8;            // W/K to the air with the fan off
+        double gPerKrpm = 0.6;          // W/K per 1000 RPM
+        double fanMaxRpm = 3000;        // At full PWM
+        double ambient = 25;            // C
+    };
+
+    class Plant
+    {
+    public:
+        PlantParams params;
+
+        // Starts the model from a cold, discharged output. While off, the
+        // ADC and analog inputs read what the script sets.
+        void setOn(bool on);
+
+        bool isOn()
+        {
+            return on;
+        }
+
+        // A resistive load in ohms (0 for none) in parallel with a constant
+        // current sink in A, like an electronic load
+        void setLoad(double ohms, double amps);
+
+        void setAmbient(double c);
+
+        // Prints the state every intervalUs until untilUs of simulated time
+        void trace(uint64_t untilUs, uint32_t intervalUs);
+
+        // Advances the model to the current simulated time
+        void update();
+
+        uint16_t readAdc(uint8_t channel);
+
+        int readThermistor();
+
+        void print();
+
+    private:
+        bool on = false;
+        uint64_t last = 0;
+        double volt = 0;         // V at the output capacitor
+        double amp = 0;          // A sourced through the sense resistor
+        bool limiting = false;   // In constant current
+        bool settled = false;    // The last step changed nothing, with the same inputs
+        uint16_t voltCode = 0;   // DAC codes at the last step
+        uint16_t ampCode = 0;
+        double heatsink = 25;    // C
+        double loadOhms = 0;
+        double loadAmps = 0;
+        uint16_t rpm = 0;
+        uint32_t seed = 1;
+        uint64_t traceUntil = 0;
+        uint64_t traceNext = 0;
+        uint32_t traceInterval = 0;
+
+        void step(double dt);
+
+        uint16_t toCode(double v);
+    };
+
+    extern Plant plant;
+}
+#endif
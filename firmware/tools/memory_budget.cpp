@@ -0,0 +1,77 @@
+// Reports the flash and RAM each module of the target build takes, from the
+// object files PlatformIO leaves behind.
+//
+//   g++ -O2 -o memory_budget tools/memory_budget.cpp
+//   pio run && avr-size .pio/build/itsybitsy32u4_5V/src/*.o | ./memory_budget
+//
+// Flash is .text plus .data, as initial values are copied from flash at
+// boot, and RAM is .data plus .bss. Modules are listed largest RAM first.
+// The stack, the Arduino core and the libraries come on top of the total;
+// the stack headroom left over is what DIAGnostic:MEMory? reports in a
+// profile build.
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define RAM_SIZE 2560 // ATmega32U4
+#define FLASH_SIZE 28672 // 32 KB less the 4 KB Caterina bootloader
+
+namespace
+{
+    struct Module
+    {
+        std::string name;
+        unsigned long flash;
+        unsigned long ram;
+    };
+
+    // "src/main.cpp.o" -> "main.cpp"
+    std::string moduleName(const char *path)
+    {
+        const char *slash = strrchr(path, '/');
+        std::string name = slash ? slash + 1 : path;
+        if (name.size() > 2 && name.compare(name.size() - 2, 2, ".o") == 0)
+        {
+            name.resize(name.size() - 2);
+        }
+        return name;
+    }
+}
+
+int main()
+{
+    // avr-size's default (Berkeley) format: text data bss dec hex filename
+    std::vector<Module> modules;
+    char line[512];
+    while (fgets(line, sizeof(line), stdin))
+    {
+        unsigned long text, data, bss, dec;
+        char hex[32], path[400];
+        if (sscanf(line, "%lu %lu %lu %lu %31s %399s", &text, &data, &bss, &dec, hex, path) == 6)
+        {
+            modules.push_back({moduleName(path), text + data, data + bss});
+        }
+    }
+    if (modules.empty())
+    {
+        fprintf(stderr, "no avr-size output on stdin\n");
+        return 1;
+    }
+
+    std::sort(modules.begin(), modules.end(), [](const Module &a, const Module &b)
+              { return a.ram != b.ram ? a.ram > b.ram : a.flash > b.flash; });
+    unsigned long flash = 0, ram = 0;
+    printf("%-24s %7s %7s\n", "module", "flash", "ram");
+    for (const Module &m : modules)
+    {
+        printf("%-24s %7lu %7lu\n", m.name.c_str(), m.flash, m.ram);
+        flash += m.flash;
+        ram += m.ram;
+    }
+    printf("%-24s %7lu %7lu\n", "total", flash, ram);
+    printf("%-24s %6.1f%% %6.1f%%\n", "of the 32u4", 100.0 * flash / FLASH_SIZE, 100.0 * ram / RAM_SIZE);
+    return 0;
+}
@@ -0,0 +1,159 @@
+// Decodes the binary telemetry stream (see src/TelemetryFormat.hpp) into CSV.
+//
+//   g++ -O2 -o telemetry_decode tools/telemetry_decode.cpp
+//   stty -F /dev/ttyACM0 raw 115200 && ./telemetry_decode /dev/ttyACM0 > soak.csv
+//
+// Reads from the file given on the command line, or stdin. Delta frames count
+// time in sample periods of the streamed output, 500 us by default. Pass
+// -p <us> if that differs: -p 1000 for a dual build (NUM_CHANNELS=2), where
+// each output is sampled at half of SAMPLE_RATE. Anything that isn't a frame
+// with a valid CRC (such as SCPI replies) is skipped. Dropped frames are
+// reported on stderr at the end.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "../src/TelemetryFormat.hpp"
+
+namespace
+{
+    struct Values
+    {
+        uint16_t seq;
+        uint64_t time;
+        int32_t rawVolt;
+        int32_t rawAmp;
+        int32_t volt;
+        int32_t amp;
+        int32_t temp;
+        int32_t rpm;
+    };
+
+    uint16_t get16(const uint8_t *p)
+    {
+        return p[0] | (p[1] << 8);
+    }
+
+    bool crcOk(const uint8_t *frame, size_t n)
+    {
+        uint8_t crc = 0;
+        for (size_t i = 1; i < n - 1; i++)
+        {
+            crc = telemetryCrc(crc, frame[i]);
+        }
+        return crc == frame[n - 1];
+    }
+}
+
+int main(int argc, char **argv)
+{
+    FILE *in = stdin;
+    uint32_t samplePeriod = 500;
+    int arg = 1;
+    if (argc > arg + 1 && !strcmp(argv[arg], "-p"))
+    {
+        samplePeriod = atoi(argv[arg + 1]);
+        arg += 2;
+    }
+    if (argc > arg && !(in = fopen(argv[arg], "rb")))
+    {
+        perror(argv[arg]);
+        return 1;
+    }
+
+    std::vector<uint8_t> buf;
+    Values v = {};
+    bool haveKey = false;
+    uint32_t keyTime = 0;
+    uint64_t timeBase = 0;
+    uint64_t frames = 0, dropped = 0, skipped = 0;
+
+    printf("seq,time_us,raw_volt,raw_amp,millivolts,milliamps,temp_c,rpm\n");
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0)
+    {
+        buf.insert(buf.end(), chunk, chunk + n);
+        size_t pos = 0;
+        while (pos < buf.size())
+        {
+            const uint8_t *p = &buf[pos];
+            size_t left = buf.size() - pos;
+            if (p[0] != TELEMETRY_SYNC)
+            {
+                pos++;
+                skipped++;
+                continue;
+            }
+            if (left < 2)
+            {
+                break;
+            }
+            size_t size = p[1] == TELEMETRY_KEY ? TELEMETRY_KEY_SIZE : p[1] == TELEMETRY_DELTA ? TELEMETRY_DELTA_SIZE : 0;
+            if (size == 0 || (left >= size && !crcOk(p, size)))
+            {
+                pos++;
+                skipped++;
+                continue;
+            }
+            if (left < size)
+            {
+                break;
+            }
+            pos += size;
+
+            uint16_t seq;
+            if (p[1] == TELEMETRY_KEY)
+            {
+                seq = get16(p + 2);
+                uint32_t time = get16(p + 4) | ((uint32_t)get16(p + 6) << 16);
+                if (haveKey && time < keyTime)
+                {
+                    timeBase += 1ULL << 32; // The 32 bit timestamp wrapped
+                }
+                keyTime = time;
+                v.time = timeBase + time;
+                v.rawVolt = get16(p + 8);
+                v.rawAmp = get16(p + 10);
+                v.volt = get16(p + 12);
+                v.amp = get16(p + 14);
+                v.temp = (int16_t)get16(p + 16);
+                v.rpm = get16(p + 18);
+                haveKey = true;
+            }
+            else
+            {
+                if (!haveKey)
+                {
+                    continue;
+                }
+                seq = (v.seq & 0xff00) | p[2];
+                if (seq < v.seq)
+                {
+                    seq += 0x100;
+                }
+                v.rawVolt += (int8_t)p[4];
+                v.rawAmp += (int8_t)p[5];
+                v.volt += (int8_t)p[6];
+                v.amp += (int8_t)p[7];
+                v.temp += (int8_t)p[8];
+                v.rpm += (int8_t)p[9];
+                v.time += (uint64_t)p[3] * samplePeriod;
+            }
+            if (frames > 0 && (uint16_t)(seq - v.seq) > 1)
+            {
+                dropped += (uint16_t)(seq - v.seq) - 1;
+            }
+            v.seq = seq;
+            frames++;
+            printf("%u,%llu,%d,%d,%d,%d,%.2f,%d\n", v.seq, (unsigned long long)v.time, v.rawVolt, v.rawAmp,
+                   v.volt, v.amp, v.temp / 100.0, v.rpm);
+        }
+        buf.erase(buf.begin(), buf.begin() + pos);
+    }
+    fprintf(stderr, "frames=%llu dropped=%llu skipped_bytes=%llu\n",
+            (unsigned long long)frames, (unsigned long long)dropped, (unsigned long long)skipped);
+    return 0;
+}
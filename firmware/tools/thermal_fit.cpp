@@ -0,0 +1,199 @@
+// Fits the heatsink parameters of the thermal model (see src/ThermalModel.hpp)
+// to a heat-soak run logged with telemetry_decode.
+//
+//   g++ -O2 -o thermal_fit tools/thermal_fit.cpp
+//   ./thermal_fit soak.csv
+//
+// For a good fit, log from cold with a load that dissipates a few tens of
+// watts, and let the fan change speed a few times along the way. The run is
+// averaged over 1 s bins, and the heat balance of the heatsink
+//
+//   P = C dT/dt + (gStill + gPerKrpm * rpm / 1000) (T - ambient)
+//
+// is solved for C, gStill and gPerKrpm by least squares. P is the power in
+// the pass transistor, (input - output voltage) * current. Pass -i <mV> if the
+// rectified input isn't 38 V and -a <C> to give the ambient temperature
+// rather than taking it from the first reading. The result is printed as the
+// #defines used in main.cpp.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+namespace
+{
+    struct Bin
+    {
+        double time;
+        double power;
+        double temp;
+        double rpm;
+    };
+
+    // Solves the 3x3 system a x = b in place by Gaussian elimination
+    bool solve(double a[3][3], double b[3], double x[3])
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            int pivot = c;
+            for (int r = c + 1; r < 3; r++)
+            {
+                if (fabs(a[r][c]) > fabs(a[pivot][c]))
+                {
+                    pivot = r;
+                }
+            }
+            if (fabs(a[pivot][c]) < 1e-12)
+            {
+                return false;
+            }
+            for (int k = 0; k < 3; k++)
+            {
+                double t = a[c][k];
+                a[c][k] = a[pivot][k];
+                a[pivot][k] = t;
+            }
+            double t = b[c];
+            b[c] = b[pivot];
+            b[pivot] = t;
+            for (int r = c + 1; r < 3; r++)
+            {
+                double f = a[r][c] / a[c][c];
+                for (int k = c; k < 3; k++)
+                {
+                    a[r][k] -= f * a[c][k];
+                }
+                b[r] -= f * b[c];
+            }
+        }
+        for (int r = 2; r >= 0; r--)
+        {
+            x[r] = b[r];
+            for (int k = r + 1; k < 3; k++)
+            {
+                x[r] -= a[r][k] * x[k];
+            }
+            x[r] /= a[r][r];
+        }
+        return true;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    FILE *in = stdin;
+    double inputMv = 38000;
+    double ambient = NAN;
+    int arg = 1;
+    while (argc > arg + 1 && argv[arg][0] == '-')
+    {
+        if (!strcmp(argv[arg], "-i"))
+        {
+            inputMv = atof(argv[arg + 1]);
+        }
+        else if (!strcmp(argv[arg], "-a"))
+        {
+            ambient = atof(argv[arg + 1]);
+        }
+        else
+        {
+            break;
+        }
+        arg += 2;
+    }
+    if (argc > arg && !(in = fopen(argv[arg], "r")))
+    {
+        perror(argv[arg]);
+        return 1;
+    }
+
+    // Average the samples into 1 s bins
+    std::vector<Bin> bins;
+    Bin sum = {};
+    int n = 0;
+    double binStart = -1;
+    char line[256];
+    while (fgets(line, sizeof(line), in))
+    {
+        unsigned seq;
+        unsigned long long time;
+        int rawVolt, rawAmp, volt, amp, rpm;
+        double temp;
+        if (sscanf(line, "%u,%llu,%d,%d,%d,%d,%lf,%d", &seq, &time, &rawVolt, &rawAmp, &volt, &amp, &temp, &rpm) != 8)
+        {
+            continue;
+        }
+        double t = time / 1e6;
+        if (binStart < 0)
+        {
+            binStart = t;
+        }
+        if (t - binStart >= 1.0 && n > 0)
+        {
+            bins.push_back({sum.time / n, sum.power / n, sum.temp / n, sum.rpm / n});
+            sum = Bin();
+            n = 0;
+            binStart = t;
+        }
+        sum.time += t;
+        sum.power += (inputMv - volt) * amp / 1e6;
+        sum.temp += temp;
+        sum.rpm += rpm;
+        n++;
+    }
+    if (bins.size() < 10)
+    {
+        fprintf(stderr, "Need at least 10 s of data, got %u s\n", (unsigned)bins.size());
+        return 1;
+    }
+    if (isnan(ambient))
+    {
+        ambient = bins[0].temp;
+    }
+
+    // Normal equations for P = C dT/dt + gStill (T - ambient) + gPerKrpm (rpm / 1000) (T - ambient),
+    // with dT/dt from central differences
+    double ata[3][3] = {}, atb[3] = {};
+    for (size_t k = 1; k + 1 < bins.size(); k++)
+    {
+        double row[3];
+        row[0] = (bins[k + 1].temp - bins[k - 1].temp) / (bins[k + 1].time - bins[k - 1].time);
+        row[1] = bins[k].temp - ambient;
+        row[2] = bins[k].rpm / 1000 * (bins[k].temp - ambient);
+        for (int i = 0; i < 3; i++)
+        {
+            for (int j = 0; j < 3; j++)
+            {
+                ata[i][j] += row[i] * row[j];
+            }
+            atb[i] += row[i] * bins[k].power;
+        }
+    }
+    double x[3];
+    if (!solve(ata, atb, x))
+    {
+        fprintf(stderr, "Can't fit: the run needs both heating and some fan speed variation\n");
+        return 1;
+    }
+
+    // How well the fitted model reproduces the logged temperature
+    double model = bins[0].temp, err = 0, maxErr = 0;
+    for (size_t k = 1; k < bins.size(); k++)
+    {
+        double dt = bins[k].time - bins[k - 1].time;
+        double g = x[1] + x[2] * bins[k - 1].rpm / 1000;
+        model += dt * (bins[k - 1].power - g * (model - ambient)) / x[0];
+        double e = fabs(model - bins[k].temp);
+        err += e * e;
+        maxErr = e > maxErr ? e : maxErr;
+    }
+    printf("#define THERMAL_CAPACITY %.1f    // J/K\n", x[0]);
+    printf("#define THERMAL_G_STILL %.3f     // W/K\n", x[1]);
+    printf("#define THERMAL_G_PER_KRPM %.3f  // W/K per 1000 RPM\n", x[2]);
+    printf("#define THERMAL_AMBIENT %.1f      // C\n", ambient);
+    fprintf(stderr, "bins=%u rms=%.2fC max=%.2fC (open loop, without the thermistor correction)\n",
+            (unsigned)bins.size(), sqrt(err / (bins.size() - 1)), maxErr);
+    return 0;
+}
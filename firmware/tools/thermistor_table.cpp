@@ -0,0 +1,71 @@
+// Generates src/ThermistorTable.cpp, the ADC code to temperature table for
+// the heatsink thermistor, so the firmware never evaluates Steinhart-Hart.
+//
+//   g++ -O2 -o thermistor_table tools/thermistor_table.cpp
+//   ./thermistor_table > src/ThermistorTable.cpp
+//
+// Rerun it after changing the thermistor or the divider. Every 10 bit code
+// gets its own entry, so there is nothing to interpolate and the table is
+// exactly the formula rounded to 0.01 C. The largest difference from the
+// single precision formula the firmware used to run is printed on stderr.
+
+#include <math.h>
+#include <stdio.h>
+
+// Steinhart-Hart coefficients for the Vishay NTCALUG03A103GC
+#define THERM_COEFF_A 1.145241779e-3
+#define THERM_COEFF_B 2.314660102e-4
+#define THERM_COEFF_C 0.9841582652e-7
+
+#define R_THERM_GROUND 10000.0 // Voltage divider resistance to ground
+#define ADC_CODES 1024
+#define CHECK_MIN 0.0          // Range the table is checked against the old formula over (C)
+#define CHECK_MAX 120.0
+
+namespace
+{
+    double temp(double code)
+    {
+        double r = R_THERM_GROUND * ((ADC_CODES - 1) / code - 1.0);
+        double l = log(r);
+        return 1.0 / (THERM_COEFF_A + THERM_COEFF_B * l + THERM_COEFF_C * l * l * l) - 273.15;
+    }
+
+    // What the firmware computed before the table, in single precision
+    float tempFloat(int code)
+    {
+        float r = (R_THERM_GROUND * (1023.0 / (float)code - 1.0));
+        float l = log(r);
+        return (1.0 / (THERM_COEFF_A + THERM_COEFF_B * l + THERM_COEFF_C * l * l * l)) - 273.15;
+    }
+}
+
+int main()
+{
+    printf("// Generated by tools/thermistor_table.cpp. Do not edit.\n");
+    printf("//\n");
+    printf("// Vishay NTCALUG03A103GC over %.0f ohms to ground, A = %.10g, B = %.10g, C = %.10g\n",
+           R_THERM_GROUND, THERM_COEFF_A, THERM_COEFF_B, THERM_COEFF_C);
+    printf("#include \"ThermistorTable.hpp\"\n\n");
+    printf("const int16_t thermistorTable[THERM_TABLE_SIZE] PROGMEM = {");
+    double maxErr = 0;
+    for (int code = 0; code < ADC_CODES; code++)
+    {
+        // Both ends are an open or shorted divider, which the formula takes to
+        // absolute zero. Keep that, so a broken thermistor reads as cold.
+        double t = code == 0 || code == ADC_CODES - 1 ? -273.15 : temp(code);
+        int centi = (int)lround(t * 100);
+        printf("%s%6d,", code % 10 ? " " : "\n    ", centi);
+        if (code > 0 && code < ADC_CODES - 1)
+        {
+            double f = tempFloat(code);
+            if (f >= CHECK_MIN && f <= CHECK_MAX && fabs(centi / 100.0 - f) > maxErr)
+            {
+                maxErr = fabs(centi / 100.0 - f);
+            }
+        }
+    }
+    printf("\n};\n");
+    fprintf(stderr, "Largest difference from the float formula over %.0f-%.0f C: %.4f C\n", CHECK_MIN, CHECK_MAX, maxErr);
+    return 0;
+}